@@ -30,7 +30,7 @@ STACKSIZE equ 0x4000
 start:
 	mov esp, stack + STACKSIZE
 	mov [magic], eax
-	mov [mdb], ebx
+	mov [mbd], ebx
 	call kmain
 	cli
 .hang:
@@ -41,5 +41,5 @@ section .bss
 
 align 4
 stack:	resb STACKSIZE	; reserve stack on doubleword boundary
-magic:	resb 1
-mdb:	resb 1
+magic:	resd 1
+mbd:	resd 1
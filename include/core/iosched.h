@@ -0,0 +1,116 @@
+#ifndef _IOSCHED_H
+#define _IOSCHED_H
+
+#include <system.h>
+
+/* IOCBs shared by all devices */
+#define MAX_IOCB 32
+
+/* Entries in the device table, one per serial port */
+#define IO_DEVICE_COUNT 4
+
+/* pcb_io_status when no IOCB was free; sys_req then does the
+   request itself */
+#define IO_NO_IOCB -1
+/* device id sys_req does not know, or one claimed with io_claim */
+#define IO_BAD_DEVICE -2
+/* io_claim found requests still queued on the port */
+#define IO_BUSY -3
+
+/*
+  I/O control block
+  One READ or WRITE a process is blocked on. The process is
+  woken once the device finishes it.
+*/
+typedef struct iocb
+{
+  void *pcb;        //requester, NULL once it is gone
+  int op_code;      //READ or WRITE
+  char *buffer_ptr;
+  int *count_ptr;
+  struct iocb *next;
+} iocb;
+
+/*
+  I/O device descriptor
+  One per entry of the device table. Holds the request the
+  driver is working on and those queued behind it, oldest first.
+*/
+typedef struct
+{
+  int device_id;    //id sys_req callers use
+  int port;         //base address of the serial port
+  int open;         //the port answered when io_init opened it
+  int claimed;      //taken over by the kernel, see io_claim
+  int event_flag;   //set by the driver when active is done
+  iocb *active;
+  iocb *head;
+  iocb *tail;
+} iod;
+
+/*
+  Procedure..: io_init
+  Description..: Opens every port of the device table that is
+      present for interrupt driven I/O.
+  Returns..: 0 if the terminal port opened, or the error from com_open
+*/
+int io_init();
+
+/*
+  Procedure..: io_schedule
+  Description..: Queues a READ or WRITE of the running process on
+      its device and starts the device if it is idle. Called from
+      sys_call with the process already in the blocked queue; it is
+      made ready again when the request completes, which may be
+      right away.
+  Params..: pcb-requester, op_code-READ or WRITE, device_id,
+      buffer_ptr, count_ptr-as passed to sys_req
+  Returns..: 0 if queued, IO_NO_IOCB or an error of the device
+*/
+int io_schedule(void *pcb, int op_code, int device_id,
+		char *buffer_ptr, int *count_ptr);
+
+/*
+  Procedure..: io_complete
+  Description..: Finishes every request the driver has flagged as
+      done, wakes the requesters and starts the next request of
+      each device. Called at the top of sys_call.
+*/
+void io_complete();
+
+/*
+  Procedure..: io_sync
+  Description..: Does a READ or WRITE without a process to block,
+      halting until the driver is done. Used before the first
+      dispatch and when no IOCB is free.
+*/
+int io_sync(int op_code, int device_id, char *buffer_ptr, int *count_ptr);
+
+/*
+  Procedure..: io_claim
+  Description..: Takes a port away from sys_req, so READ and WRITE
+      requests for its device fail with IO_BAD_DEVICE until it is
+      released. Used by the trace stream, which must not have other
+      bytes mixed into it.
+  Params..: port-base address of the port
+  Returns..: 0, IO_BAD_DEVICE if the port is not in the device table
+      or already claimed, or IO_BUSY while requests are queued on it
+*/
+int io_claim(int port);
+
+/*
+  Procedure..: io_release
+  Description..: Gives a port taken with io_claim back to sys_req.
+*/
+void io_release(int port);
+
+/*
+  Procedure..: io_cancel
+  Description..: Drops every queued request of a process that is
+      being freed. A request the driver already started is aborted,
+      so the driver lets go of the process's buffer. Must run
+      before the process's memory is released.
+*/
+void io_cancel(void *pcb);
+
+#endif
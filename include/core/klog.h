@@ -0,0 +1,124 @@
+#ifndef _KLOG_H
+#define _KLOG_H
+
+#include <system.h>
+
+/* Log levels, least important first */
+#define KLOG_DEBUG 0
+#define KLOG_INFO  1
+#define KLOG_WARN  2
+#define KLOG_ERR   3
+#define KLOG_PANIC 4
+#define KLOG_LEVELS 5
+
+/* Entries kept in the ring; must be a power of two */
+#define KLOG_ENTRIES 256
+/* Longest message kept, including the NUL */
+#define KLOG_MSG_SIZE 64
+
+/* Entries the idle process writes to the console per turn */
+#define KLOG_DRAIN_BATCH 4
+
+/*
+  Kernel log entry
+  seq is 0 while the entry is being written and its index + 1
+  once it is complete, so readers can tell a finished entry
+  from one that is in progress or was overwritten.
+*/
+typedef struct
+{
+  volatile u32int seq;
+  int level;
+  u64int tsc;  //time stamp counter when it was logged
+  char msg[KLOG_MSG_SIZE];
+} klog_entry;
+
+/* Least important level the drain writes to the console */
+extern int klog_console_level;
+
+/* Time stamp counter ticks per millisecond; 0 if unknown */
+extern u32int tsc_khz;
+
+/*
+  Procedure..: klog_init
+  Description..: Measures the time stamp counter against the
+      PIT so entries can be stamped in milliseconds since boot.
+*/
+void klog_init();
+
+/*
+  Procedure..: klog
+  Description..: Formats a message (see vsnprintf) into the next
+      entry of the ring. Never waits on a device, so it is safe in
+      interrupt handlers and hot paths. Before the first dispatch
+      the ring is written out right away.
+  Params..: level-KLOG_DEBUG to KLOG_PANIC, fmt-format string
+*/
+void klog(int level, const char *fmt, ...);
+
+/*
+  Procedure..: klog_end
+  Description..: Index the next entry will get; the ring holds the
+      KLOG_ENTRIES entries before it at most.
+*/
+u32int klog_end();
+
+/*
+  Procedure..: klog_start
+  Description..: Index of the oldest entry still in the ring.
+*/
+u32int klog_start();
+
+/*
+  Procedure..: klog_get
+  Description..: Copies one entry out of the ring.
+  Params..: index-entry index, out-where to copy it
+  Returns..: 1 if the entry was complete and still in the ring
+*/
+int klog_get(u32int index, klog_entry *out);
+
+/*
+  Procedure..: klog_clear
+  Description..: Forgets every entry logged so far.
+*/
+void klog_clear();
+
+/*
+  Procedure..: klog_format
+  Description..: Writes an entry as one console line, with its
+      time since boot and level.
+  Returns..: length of the line
+*/
+int klog_format(klog_entry *e, char *buf, int size);
+
+/*
+  Procedure..: klog_level
+  Description..: Level of a name such as "warn", -1 if none.
+*/
+int klog_level(const char *name);
+
+/*
+  Procedure..: klog_level_name
+  Description..: Name of a level.
+*/
+const char *klog_level_name(int level);
+
+/*
+  Procedure..: klog_drain
+  Description..: Writes up to max pending entries to the console,
+      through the transmit ring of the serial driver when it is
+      open. Stops early rather than wait for room in the ring.
+  Returns..: nonzero while entries are pending and the ring had
+      room for them
+*/
+int klog_drain(int max);
+
+/*
+  Procedure..: klog_flush
+  Description..: Writes every pending entry to the console with
+      polled output. Used at boot and on a panic.
+  Params..: force-write even if a drain is in progress, for a panic
+*/
+void klog_flush(int force);
+
+#endif
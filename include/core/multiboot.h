@@ -0,0 +1,52 @@
+#ifndef _MULTIBOOT_H
+#define _MULTIBOOT_H
+
+#include "system.h"
+
+/* Value left in eax by a multiboot compliant boot loader */
+#define MULTIBOOT_BOOT_MAGIC 0x2BADB002
+
+/* multiboot_info flags */
+#define MULTIBOOT_INFO_MEMORY  0x001 //mem_lower and mem_upper are valid
+#define MULTIBOOT_INFO_MEM_MAP 0x040 //mmap_length and mmap_addr are valid
+
+/* Memory map entry types */
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+/*
+  Multiboot information structure
+  Handed to the kernel in ebx. Only the fields up to the
+  memory map are described; the rest are not used.
+*/
+typedef struct
+{
+  u32int flags;
+  u32int mem_lower;   //KB of memory below 1MB
+  u32int mem_upper;   //KB of memory above 1MB, up to the first hole
+  u32int boot_device;
+  u32int cmdline;
+  u32int mods_count;
+  u32int mods_addr;
+  u32int syms[4];
+  u32int mmap_length; //size of the memory map in bytes
+  u32int mmap_addr;   //physical address of the first entry
+}
+  __attribute__ ((packed)) multiboot_info;
+
+/*
+  Memory map entry
+  size does not count itself, so the next entry starts
+  size+4 bytes after this one. Addresses are 64 bits wide.
+*/
+typedef struct
+{
+  u32int size;
+  u32int base_low;
+  u32int base_high;
+  u32int length_low;
+  u32int length_high;
+  u32int type;
+}
+  __attribute__ ((packed)) multiboot_mmap_entry;
+
+#endif
@@ -6,12 +6,35 @@
 #define COM3 0x3e8
 #define COM4 0x2e8
 
+// device serial_println and friends write to
+extern int serial_port_out;
+
 /*
   Procedure..: init_serial
   Description..: Initializes devices for user interaction, logging, ...
 */
 int init_serial(int device);
 
+/*
+  Procedure..: serial_divisor
+  Description..: Returns the divisor latch value for a standard baud
+    rate from 50 to 115200, or 0 if the rate is not supported.
+*/
+int serial_divisor(int baud);
+
+/*
+  Procedure..: set_serial_baud
+  Description..: Switches a port to another baud rate once its
+    transmitter is idle. Returns 0, or -1 for an unsupported rate.
+*/
+int set_serial_baud(int device, int baud);
+
+/*
+  Procedure..: get_serial_baud
+  Description..: Returns the baud rate a port is programmed for.
+*/
+int get_serial_baud(int device);
+
 /*
   Procedure..: serial_println
   Description..: Writes a message to the active serial output device.
@@ -41,6 +64,13 @@ int set_serial_out(int device);
 */
 int set_serial_in(int device);
 
+/*
+  Procedure..: serial_rx_ready
+  Description..: Checks whether a character is waiting on COM1,
+    in the driver's receive ring or in the uart itself.
+*/
+int serial_rx_ready();
+
 /*
    Procedure:  Polling
    Description:   Gathers keyboard input via the serial port using
@@ -0,0 +1,114 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <system.h>
+#include <core/serial.h>
+
+/* Version of the record format, bump when it changes */
+#define TRACE_VERSION 1
+/* Marker in the id of the TRACE_START record */
+#define TRACE_MAGIC 0x5452
+
+/* Records held until the idle process sends them; power of two */
+#define TRACE_RECORDS 2048
+
+/* Default port the stream goes out on, and its rate */
+#define TRACE_PORT COM2
+#define TRACE_BAUD 115200
+
+/* Event types */
+#define TRACE_START   0  //aux version, id TRACE_MAGIC, value tsc_khz
+#define TRACE_SYNC    1  //value is bits 32-63 of the delta
+#define TRACE_LOST    2  //value records dropped because the buffer was full
+#define TRACE_SWITCH  3  //value pcb now running, 0 for the kernel
+#define TRACE_PCB     4  //value pcb the TRACE_NAME records after it belong to
+#define TRACE_NAME    5  //aux chunk number, value 4 bytes of the name
+#define TRACE_SYSCALL 6  //aux op code, value pcb
+#define TRACE_BLOCK   7  //aux op code, id device, value pcb waiting on I/O
+#define TRACE_WAKE    8  //value pcb made ready again
+#define TRACE_IRQ     9  //aux irq line, handler entered
+#define TRACE_IRQ_END 10 //aux irq line, handler done
+#define TRACE_ALLOC   11 //id owner tag, value bytes
+#define TRACE_FREE    12 //id owner tag, value bytes
+
+/*
+  Trace record
+  Every record is 12 bytes, little endian. delta is the number of
+  time stamp counter ticks since the record before it; a TRACE_SYNC
+  record carries the high half when that does not fit.
+*/
+typedef struct
+{
+  u8int event;
+  u8int aux;
+  u16int id;
+  u32int delta;
+  u32int value;
+} __attribute__ ((packed)) trace_rec;
+
+/* Set while events are being recorded */
+extern volatile int trace_on;
+
+/*
+  Procedure..: trace_event
+  Description..: Records one event if tracing is on. Takes well
+      under a microsecond and never waits on the port.
+  Params..: event-TRACE_*, aux, id, value-see the event types
+*/
+void trace_event(int event, int aux, int id, u32int value);
+
+/* Cheap check first so call sites cost one compare while off */
+#define TRACE(event, aux, id, value) \
+  do { if (trace_on) trace_event((event), (aux), (id), (u32int)(value)); } while (0)
+
+/*
+  Procedure..: trace_name
+  Description..: Records the name of a process, so the decoder
+      can show it instead of the pcb address.
+*/
+void trace_name(void *pcb, const char *name);
+
+/*
+  Procedure..: trace_quiet
+  Description..: Leaves out the IDLE calls of a process that does
+      nothing but yield, so the idle loop does not fill the buffer
+      with its own events. Switches to the process that is already
+      running are never recorded.
+  Params..: pcb-the process, NULL for none
+*/
+void trace_quiet(void *pcb);
+
+/*
+  Procedure..: trace_start
+  Description..: Opens the stream on a port at TRACE_BAUD and
+      starts recording. The port is claimed from sys_req until
+      the stream has drained after trace_stop.
+  Params..: port-base address of an open serial port
+  Returns..: 0, the error of io_claim, or that of the serial driver
+*/
+int trace_start(int port);
+
+/*
+  Procedure..: trace_stop
+  Description..: Stops recording. Records already taken are still
+      sent.
+*/
+void trace_stop();
+
+/*
+  Procedure..: trace_drain
+  Description..: Sends pending records through the transmit ring
+      of the trace port until they are all out or the ring is
+      full, without waiting for room. Records left behind go once
+      the THRE interrupt wakes the idle process again.
+*/
+void trace_drain();
+
+/*
+  Procedure..: trace_stats
+  Description..: Reports the port, the records taken, sent and
+      dropped since the last trace_start.
+*/
+void trace_stats(int *port, u32int *taken, u32int *sent, u32int *lost);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef _BUDDY_H
+#define _BUDDY_H
+
+#include <system.h>
+
+/* Largest block handed out by the buddy allocator: 2^10 pages (4MB) */
+#define BUDDY_MAX_ORDER  10
+#define BUDDY_POOL_PAGES (1 << BUDDY_MAX_ORDER)
+#define BUDDY_POOL_SIZE  (BUDDY_POOL_PAGES * 0x1000)
+
+/*
+  Procedure..: init_buddy
+  Description..: Hands a physically contiguous, identity mapped
+    run of frames to the buddy allocator. The frames must already
+    be marked as in use in the frame bitmap.
+  Parameters..: base   - page aligned address of the first frame
+                npages - number of frames in the pool
+*/
+void init_buddy(u32int base, u32int npages);
+
+/*
+  Procedure..: alloc_pages
+  Description..: Allocates a run of 2^order contiguous pages.
+      Larger free blocks are split in half until the request fits.
+      Returns the page aligned address, or 0 if no block is free.
+*/
+u32int alloc_pages(u32int order);
+
+/*
+  Procedure..: free_pages
+  Description..: Returns a block obtained from alloc_pages. The block
+      is merged with its buddy for as long as the buddy is free.
+      Returns 0 on success, -1 if addr is not an allocated block.
+*/
+int free_pages(u32int addr);
+
+/*
+  Procedure..: buddy_block_size
+  Description..: Size in bytes of an allocated block, 0 if addr
+      is not the start of one.
+*/
+u32int buddy_block_size(u32int addr);
+
+/*
+  Procedure..: buddy_owns
+  Description..: Checks if an address lies inside the buddy pool.
+*/
+int buddy_owns(u32int addr);
+
+/*
+  Procedure..: pages_to_order
+  Description..: Smallest order whose block holds npages pages.
+*/
+u32int pages_to_order(u32int npages);
+
+#endif
@@ -5,7 +5,8 @@
 #define TABLE_SIZE 0x1000
 #define KHEAP_BASE 0xD000000
 #define KHEAP_MIN  0x10000
-#define KHEAP_SIZE 0x1000000
+#define KHEAP_SIZE 0x1000000  //max size until detect_memory scales it
+#define KHEAP_MAX_SIZE 0x10000000
 
 /* Heap allocation header */
 typedef struct {
@@ -35,13 +36,19 @@ typedef struct {
   u32int base;
   u32int max_size;
   u32int min_size;
+  u32int start; //first block, past this structure
+  u32int end;   //end of the mapped heap area
 } heap;
 
+extern u32int kheap_size; //max size of the kernel heap
+
 /*
   Procedure..: _kmalloc
   Description..: Base-level kernel memory allocation routine. Used to
       provide page alignment and access physical addresses of allocations.
-      Called by kmalloc with align=0, physical_address=0.
+      Called by kmalloc with align=0, physical_address=0. Once the heap
+      exists, a physical address request that may cross a page is served
+      by the buddy pool and must be released with free_pages.
 */
 u32int _kmalloc(u32int size, int align, u32int *phys_addr);
 
@@ -54,9 +61,18 @@ u32int kmalloc(u32int size);
 
 /*
   Procedure..: kfree
-  Description..: Free kernel memory.
+  Description..: Free kernel memory. The block is merged with
+      free neighbours. Returns 0 on success, -1 if addr was not
+      allocated from the kernel heap.
+*/
+int kfree(u32int addr);
+
+/*
+  Procedure..: ksize
+  Description..: Usable size of a block allocated from the kernel
+      heap, 0 if addr was not allocated from it.
 */
-u32int kfree();
+u32int ksize(u32int addr);
 
 /*
   Procedure..: init_kheap
@@ -67,13 +83,23 @@ void init_kheap();
 /*
   Procedure..: alloc
   Description..: Allocate some memory using the given heap. Can specify page-alignment.
+      The heap is grown, up to its max size, when no hole fits.
 */
 u32int alloc(u32int size, heap *hp, int align);
 
+/*
+  Procedure..: alloc_aligned
+  Description..: Allocate memory whose address is a multiple of
+      alignment (a power of two). Any padding in front of the block
+      is left as a hole, so it stays usable.
+*/
+u32int alloc_aligned(u32int size, heap *hp, u32int alignment);
+
 /*
   Procedure..: make_heap
-  Description..: Create a new heap.
-  Parameters..: base - physical start address of the heap
+  Description..: Create a new heap. The heap structure itself is
+      kept at the base of the (already mapped) heap area.
+  Parameters..: base - start address of the heap
                 max  - maximum size the heap may grow to
 		min  - minimum/initial size
 */
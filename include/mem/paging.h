@@ -5,6 +5,26 @@
 
 #define PAGE_SIZE 0x1000
 
+/* Memory assumed when the boot loader gives no memory map */
+#define DEFAULT_MEM_SIZE 0x4000000 //64MB
+#define LARGE_PAGE_SIZE 0x400000
+
+/* Page directory entry flags */
+#define PDE_PRESENT   0x01
+#define PDE_WRITEABLE 0x02
+#define PDE_USERMODE  0x04
+#define PDE_LARGE     0x80 //4MB page, needs cr4.PSE
+
+/*
+  Per-process part of the address space. Directory entries
+  outside of it are shared with the kernel directory.
+*/
+#define PROC_SPACE_BASE 0x40000000
+#define PROC_SPACE_END  0x80000000
+
+/* Kernel page used to reach a frame that is not mapped anywhere else */
+#define SCRATCH_PAGE 0xCFFF000
+
 /*
   Page entry structure
   Describes a single page in memory
@@ -13,12 +33,35 @@ typedef struct {
   u32int present   : 1;
   u32int writeable : 1;
   u32int usermode  : 1;
+  u32int writethru : 1;
+  u32int nocache   : 1;
   u32int accessed  : 1;
   u32int dirty     : 1;
-  u32int reserved  : 7;
+  u32int reserved  : 2;
+  u32int cow       : 1; //copy on write; available to the OS
+  u32int avail     : 2;
   u32int frameaddr : 20;
 } page_entry;
 
+/* Region flags */
+#define REGION_WRITEABLE 0x1
+#define REGION_USERMODE  0x2
+
+#define MAX_REGIONS 32
+
+/*
+  Region descriptor
+  A range of virtual memory that is backed by zeroed frames
+  on first touch. dir is the owning directory, or 0 for a
+  region present in every address space.
+*/
+typedef struct region {
+  u32int start;
+  u32int end;
+  u32int flags;
+  void *dir;
+} region;
+
 /*
   Page table structure
   Contains 1024 pages/frames
@@ -36,6 +79,22 @@ typedef struct {
   u32int tables_phys[1024];
 } page_dir;
 
+extern page_dir *kdir; //kernel page directory
+extern page_dir *cdir; //current page directory
+extern u32int mem_size; //end of usable physical memory
+
+/*
+  Procedure..: detect_memory
+  Description..: Reads the usable RAM ranges from the multiboot
+    memory map, falling back to the basic lower/upper sizes and
+    then to DEFAULT_MEM_SIZE. Sets mem_size to the end of the
+    highest range and scales the kernel heap limit to it. Must
+    run before init_paging.
+  Parameters..: mbd - multiboot information from the boot loader,
+                      0 if there is none
+*/
+void detect_memory(void *mbd);
+
 /*
   Procedure..: set_bit
   Description..: Marks a page frame bit as in use (1).
@@ -55,17 +114,19 @@ void clear_bit(u32int addr);
 u32int get_bit(u32int addr);
 
 /*
-  Procedure..: first_free
-  Description..: Finds the first free page frame.
+  Procedure..: find_free
+  Description..: Finds a free page frame using the summary
+    bitmap and the cache of recently freed frames.
 */
-u32int first_free();
+u32int find_free();
 
 /*
   Procedure..: init_paging
   Description..: Initializes the kernel page directory and 
     initial kernel heap area. Performs identity mapping of
     the kernel frames such that the virtual addresses are
-    equivalent to the physical addresses.
+    equivalent to the physical addresses, using 4MB pages
+    when the cpu supports them.
 */
 void init_paging();
 
@@ -82,7 +143,8 @@ void load_page_dir(page_dir *new_page_dir);
 /*
   Procedure..: get_page
   Description..: Finds and returns a page, allocating a new 
-   page table if necessary.
+   page table if necessary. Returns 0 for addresses covered
+   by a 4MB page.
 */
 page_entry* get_page(u32int addr, page_dir *dir, int make_table);
 
@@ -93,4 +155,91 @@ page_entry* get_page(u32int addr, page_dir *dir, int make_table);
 */
 void new_frame(page_entry* page);
 
+/*
+  Procedure..: free_frame
+  Description..: Releases the frame backing a page and
+    marks the page as not present.
+*/
+void free_frame(page_entry* page);
+
+/*
+  Procedure..: refill_frame_cache
+  Description..: Tops up the cache of free frames that new_frame
+    takes from first, a few bitmap words per call. Meant for
+    idle time.
+*/
+void refill_frame_cache();
+
+/*
+  Procedure..: switch_page_dir
+  Description..: Makes a page directory the current one by
+    loading cr3. Paging must already be enabled.
+*/
+void switch_page_dir(page_dir *dir);
+
+/*
+  Procedure..: clone_dir
+  Description..: Creates a page directory for a new address
+    space. Kernel mappings are shared with src; pages in the
+    per-process space are shared copy-on-write. Returns 0 if
+    no memory is left for the directory.
+*/
+page_dir* clone_dir(page_dir *src);
+
+/*
+  Procedure..: free_dir
+  Description..: Releases a directory made by clone_dir along
+    with its private page tables and frames.
+*/
+void free_dir(page_dir *dir);
+
+/*
+  Procedure..: map_cow
+  Description..: Maps the page at src_addr in src into dst at
+    dst_addr, sharing the frame. Writable pages become read-only
+    in both directories and are copied on the first write.
+    Returns 0 on success, -1 if src_addr is not mapped.
+*/
+int map_cow(page_dir *dst, u32int dst_addr, page_dir *src, u32int src_addr);
+
+/*
+  Procedure..: cow_fault
+  Description..: Resolves a write to a copy-on-write page of the
+    current directory. Returns 1 if the fault was handled.
+*/
+int cow_fault(u32int addr);
+
+/*
+  Procedure..: add_region
+  Description..: Reserves [start, end) as a demand-zero region.
+    Pages are not backed until they are touched. Returns 0 on
+    success, -1 if the region table is full or the range is bad.
+  Parameters..: dir   - owning directory, 0 for all directories
+                start - page aligned start address
+                end   - page aligned end address
+                flags - REGION_* flags for the pages
+*/
+int add_region(page_dir *dir, u32int start, u32int end, u32int flags);
+
+/*
+  Procedure..: remove_regions
+  Description..: Drops every region owned by a directory.
+*/
+void remove_regions(page_dir *dir);
+
+/*
+  Procedure..: find_region
+  Description..: Finds the region of the current directory that
+    holds addr. Returns 0 if the address is not in any region.
+*/
+region* find_region(u32int addr);
+
+/*
+  Procedure..: zero_fault
+  Description..: Resolves an access to a not present page. If the
+    address lies in a region, the page is backed with a zeroed
+    frame. Returns 1 if the fault was handled.
+*/
+int zero_fault(u32int addr, u32int write);
+
 #endif
@@ -2,6 +2,7 @@
 #define _STRING_H
 
 #include <system.h>
+#include <stdarg.h>
 
 /*
   Procedure..: isspace
@@ -17,6 +18,13 @@ int isspace(const char *c);
 */
 void* memset(void *s, int c, size_t n);
 
+/*
+  Procedure..: memcpy
+  Description..: Copy a region of memory. The regions must not overlap.
+  Params..: s1-destination, s2-source, n-count
+*/
+void* memcpy(void *s1, const void *s2, size_t n);
+
 /*
   Procedure..: strcpy
   Description..: Copy one string to another.
@@ -68,8 +76,35 @@ int atoi(const char *s);
  * 
  * @param i Integer that will be converted into ascii
  * 
- * @return Returns a pointer to the start of the array of character bytes 
+ * @return Returns a pointer to the start of the array of character bytes.
+ *  The array is reused by the next call.
 */
 char *itoa(int i);
 
+/*
+  Procedure..: vsnprintf
+  Description..: Formats into str, writing at most size bytes
+      including the terminating NUL. Supports the -, 0, + and space
+      flags, width, precision, the l modifier and %d %i %u %x %X %p
+      %c %s %%.
+  Params..: str-destination, size-size of str, fmt-format string,
+      ap-arguments
+  Returns..: length the full output would have had
+*/
+int vsnprintf(char *str, size_t size, const char *fmt, va_list ap);
+
+/*
+  Procedure..: snprintf
+  Description..: Formats into str, writing at most size bytes.
+  Params..: str-destination, size-size of str, fmt-format string
+*/
+int snprintf(char *str, size_t size, const char *fmt, ...);
+
+/*
+  Procedure..: sprintf
+  Description..: Formats into str without a bound.
+  Params..: str-destination, fmt-format string
+*/
+int sprintf(char *str, const char *fmt, ...);
+
 #endif
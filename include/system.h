@@ -25,6 +25,7 @@ typedef unsigned int   size_t;
 typedef unsigned char  u8int;
 typedef unsigned short u16int;
 typedef unsigned long  u32int;
+typedef unsigned long long u64int;
 
 /* Time */
 typedef struct {
@@ -38,6 +39,14 @@ typedef struct {
   int year;
 } date_time;
 
+/* Read the time stamp counter */
+static inline u64int rdtsc()
+{
+  u64int t;
+  asm volatile ("rdtsc" : "=A"(t));
+  return t;
+}
+
 /* Test if interrupts are on */
 static inline int irq_on()
 {
@@ -51,4 +60,19 @@ static inline int irq_on()
 void klogv(const char *msg);
 void kpanic(const char *msg);
 
+/*
+  Procedure..: wait_for_input
+  Description..: Blocks the running process until a character
+      arrives on the terminal. Other processes run in the meantime.
+      Several processes may wait at once; all of them are woken.
+*/
+void wait_for_input();
+
+/*
+  Procedure..: idle_sleep
+  Description..: Halts the cpu until the next interrupt when no
+      process is READY and nothing has been typed.
+*/
+void idle_sleep();
+
 #endif
@@ -11,6 +11,8 @@
 #include <core/serial.h>
 #include <core/tables.h>
 #include <core/interrupts.h>
+#include <mem/paging.h>
+#include <core/klog.h>
 
 // Programmable Interrupt Controllers
 #define PIC1 0x20
@@ -185,8 +187,19 @@ void do_general_protection()
 {
   kpanic("General protection fault");
 }
-void do_page_fault()
+void do_page_fault(u32int error)
 {
+  u32int addr;
+  asm volatile ("mov %%cr2,%0" : "=r"(addr));
+
+  //write to a present page: may be a copy-on-write page
+  if ((error & 0x3) == 0x3 && cow_fault(addr)){
+    klog(KLOG_DEBUG, "Copy-on-write fault at %x", addr);
+    return;
+  }
+  //first touch of a page inside a demand-zero region
+  if (!(error & 0x1) && zero_fault(addr, error & 0x2))
+    return;
   kpanic("Page Fault");
 }
 void do_reserved()
@@ -0,0 +1,260 @@
+/*
+  ----- iosched.c -----
+
+  Description..: Queues the READ and WRITE requests processes
+      make through sys_req, so a process waiting on the serial
+      port is blocked while the others keep running.
+*/
+
+#include <system.h>
+#include <string.h>
+
+#include <core/iosched.h>
+#include <core/trace.h>
+#include <core/serial.h>
+#include <modules/mpx_supt.h>
+#include <serial_driver/driver.h>
+
+#include "term/pcb/pcb.h"
+
+static iocb iocbs[MAX_IOCB];
+static iocb *free_iocbs = NULL;
+
+// device table; the terminal stays on COM1 while the other
+// ports are free for logs and traces
+static iod devices[IO_DEVICE_COUNT] = {
+  { .device_id = DEFAULT_DEVICE, .port = COM1 },
+  { .device_id = COM_PORT,       .port = COM2 },
+  { .device_id = COM3_PORT,      .port = COM3 },
+  { .device_id = COM4_PORT,      .port = COM4 },
+};
+
+/*
+  Procedure..: io_device
+  Description..: Maps a sys_req device id to its descriptor.
+      Returns NULL for an unknown id, a port that did not open or
+      one the kernel claimed.
+*/
+static iod *io_device(int device_id)
+{
+  int i;
+  for (i = 0; i < IO_DEVICE_COUNT; i++)
+    if (devices[i].device_id == device_id)
+      return devices[i].open && !devices[i].claimed ? &devices[i] : NULL;
+  return NULL;
+}
+
+/*
+  Procedure..: io_port
+  Description..: Finds the descriptor of a port, NULL if it is
+      not in the device table.
+*/
+static iod *io_port(int port)
+{
+  int i;
+  for (i = 0; i < IO_DEVICE_COUNT; i++)
+    if (devices[i].port == port)
+      return &devices[i];
+  return NULL;
+}
+
+int io_init()
+{
+  iod *dev;
+  int i, rc;
+
+  free_iocbs = NULL;
+  for (i = 0; i < MAX_IOCB; i++){
+    iocbs[i].next = free_iocbs;
+    free_iocbs = &iocbs[i];
+  }
+
+  //ports that are not there just stay closed
+  for (i = IO_DEVICE_COUNT - 1; i >= 0; i--){
+    dev = &devices[i];
+    dev->event_flag = 0;
+    dev->active = dev->head = dev->tail = NULL;
+    dev->claimed = 0;
+    rc = com_open(dev->port, &dev->event_flag, 9600);
+    dev->open = rc == 0;
+  }
+  //rc is now that of the terminal
+  return rc;
+}
+
+/*
+  Procedure..: io_wake
+  Description..: Moves a finished request's process back to the
+      ready queue, records the result and frees the IOCB.
+*/
+static void io_wake(iocb *r, int status)
+{
+  pcb_t *pcb = (pcb_t*)r->pcb;
+
+  if (pcb != NULL){
+    pcb->pcb_io_status = status;
+    removePCB(pcb);
+    if (pcb->pcb_process_state == SUSPENDED_BLOCKED)
+      pcb->pcb_process_state = SUSPENDED_READY;
+    else
+      pcb->pcb_process_state = READY;
+    insertPCB(pcb);
+    TRACE(TRACE_WAKE, 0, 0, pcb);
+  }
+  r->next = free_iocbs;
+  free_iocbs = r;
+}
+
+/*
+  Procedure..: io_start
+  Description..: Hands queued requests to the driver until one of
+      them is left running. Writes that fit in the transmit ring
+      complete at once.
+*/
+static void io_start(iod *dev)
+{
+  iocb *r;
+  int rc;
+
+  while (dev->active == NULL && dev->head != NULL){
+    r = dev->head;
+    dev->head = r->next;
+    if (dev->head == NULL)
+      dev->tail = NULL;
+
+    if (r->op_code == READ)
+      rc = com_read(dev->port, r->buffer_ptr, r->count_ptr);
+    else
+      rc = com_write(dev->port, r->buffer_ptr, r->count_ptr);
+
+    if (rc != 0)
+      io_wake(r, rc);
+    else if (dev->event_flag)
+      io_wake(r, 0);
+    else
+      dev->active = r;
+  }
+}
+
+int io_schedule(void *pcb, int op_code, int device_id,
+		char *buffer_ptr, int *count_ptr)
+{
+  iod *dev = io_device(device_id);
+  iocb *r = free_iocbs;
+
+  if (dev == NULL)
+    return IO_BAD_DEVICE;
+  if (r == NULL)
+    return IO_NO_IOCB;
+  free_iocbs = r->next;
+
+  r->pcb = pcb;
+  r->op_code = op_code;
+  r->buffer_ptr = buffer_ptr;
+  r->count_ptr = count_ptr;
+  r->next = NULL;
+  if (dev->tail != NULL)
+    dev->tail->next = r;
+  else
+    dev->head = r;
+  dev->tail = r;
+  TRACE(TRACE_BLOCK, op_code, dev - devices, pcb);
+
+  io_start(dev);
+  return 0;
+}
+
+void io_complete()
+{
+  iod *dev;
+  int i;
+
+  for (i = 0; i < IO_DEVICE_COUNT; i++){
+    dev = &devices[i];
+    if (dev->active != NULL && dev->event_flag){
+      io_wake(dev->active, 0);
+      dev->active = NULL;
+    }
+    io_start(dev);
+  }
+}
+
+int io_sync(int op_code, int device_id, char *buffer_ptr, int *count_ptr)
+{
+  iod *dev = io_device(device_id);
+  int rc;
+
+  if (dev == NULL)
+    return IO_BAD_DEVICE;
+
+  // let the queue drain so requests stay in order
+  while (dev->active != NULL || dev->head != NULL){
+    com_sleep(&dev->event_flag);
+    io_complete();
+  }
+
+  if (op_code == READ)
+    rc = com_read(dev->port, buffer_ptr, count_ptr);
+  else
+    rc = com_write(dev->port, buffer_ptr, count_ptr);
+  if (rc != 0)
+    return rc;
+
+  while (!dev->event_flag)
+    com_sleep(&dev->event_flag);
+  return 0;
+}
+
+int io_claim(int port)
+{
+  iod *dev = io_port(port);
+
+  if (dev == NULL || dev->claimed)
+    return IO_BAD_DEVICE;
+  if (dev->active != NULL || dev->head != NULL)
+    return IO_BUSY;
+  dev->claimed = 1;
+  return 0;
+}
+
+void io_release(int port)
+{
+  iod *dev = io_port(port);
+
+  if (dev != NULL)
+    dev->claimed = 0;
+}
+
+void io_cancel(void *pcb)
+{
+  iod *dev;
+  iocb **link, *r;
+  int i;
+
+  for (i = 0; i < IO_DEVICE_COUNT; i++){
+    dev = &devices[i];
+    if (dev->active != NULL && dev->active->pcb == pcb){
+      // the buffer is about to be freed; the next request starts
+      // from io_complete
+      com_abort(dev->port);
+      r = dev->active;
+      dev->active = NULL;
+      r->next = free_iocbs;
+      free_iocbs = r;
+    }
+
+    dev->tail = NULL;
+    link = &dev->head;
+    while ((r = *link) != NULL){
+      if (r->pcb == pcb){
+	*link = r->next;
+	r->next = free_iocbs;
+	free_iocbs = r;
+      }
+      else {
+	dev->tail = r;
+	link = &r->next;
+      }
+    }
+  }
+}
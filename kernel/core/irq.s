@@ -25,6 +25,8 @@
 [GLOBAL coprocessor]
 [GLOBAL rtc_isr]
 [GLOBAL sys_call_isr]
+[GLOBAL serial_irq4_isr]
+[GLOBAL serial_irq3_isr]
 
 ;; Names of the C handlers
 extern do_divide_error
@@ -45,6 +47,7 @@ extern do_page_fault
 extern do_reserved
 extern do_coprocessor
 extern sys_call
+extern com_isr
 
 ; RTC interrupt handler
 ; Tells the slave PIC to ignore
@@ -107,7 +110,15 @@ general_protection:
 	call do_general_protection
 	iret
 page_fault:
+	; the cpu pushed an error code; hand it to the
+	; handler and drop it before returning so the
+	; faulting instruction can be restarted
+	pusha
+	push dword [esp+32]
 	call do_page_fault
+	add esp, 4
+	popa
+	add esp, 4
 	iret
 reserved:
 	call do_reserved
@@ -151,3 +162,23 @@ sys_call_isr:
 
 	; Return from interrupt
 	iret 			
+
+;;; COM1 and COM3 interrupt handler. The C handler services the
+;;; uarts and acknowledges the PIC. Only general registers need
+;;; saving since every segment register holds the kernel's
+serial_irq4_isr:
+	pusha
+	push dword 4
+	call com_isr
+	add esp, 4
+	popa
+	iret
+
+;;; Same for COM2 and COM4
+serial_irq3_isr:
+	pusha
+	push dword 3
+	call com_isr
+	add esp, 4
+	popa
+	iret
@@ -0,0 +1,243 @@
+/*
+  ----- klog.c -----
+
+  Description..: Kernel log. Messages go into a ring in memory
+      and are written to the console later by the idle process,
+      so logging never waits on the serial port.
+*/
+
+#include <system.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include <core/io.h>
+#include <core/klog.h>
+#include <core/serial.h>
+#include <serial_driver/driver.h>
+
+#include "term/pcb/pcb.h"
+
+#define KLOG_MASK (KLOG_ENTRIES - 1)
+#define KLOG_LINE_SIZE (KLOG_MSG_SIZE + 24)
+
+// PIT channel 2, gated through the speaker port
+#define PIT_CH2    0x42
+#define PIT_CMD    0x43
+#define SPEAKER    0x61
+#define PIT_HZ     1193182
+#define CALIBRATE_MS 10
+
+extern pcb_t *cop; // running process, defined in system.c
+
+int klog_console_level = KLOG_INFO;
+u32int tsc_khz = 0;
+
+static klog_entry ring[KLOG_ENTRIES];
+static volatile u32int next_index = 0;  // index the next entry gets
+static u32int first_index = 0;          // entries before it were cleared
+static u32int drain_index = 0;          // next entry for the console
+static volatile int draining = 0;
+static u64int boot_tsc = 0;
+
+static const char *level_names[KLOG_LEVELS] = {
+  "debug", "info", "warn", "err", "panic"
+};
+
+void klog_init()
+{
+  u64int start;
+  u32int spins = 0;
+
+  boot_tsc = rdtsc();
+
+  // gate off, load a one-shot count, then gate on to start it
+  outb(SPEAKER, inb(SPEAKER) & ~0x03);
+  outb(PIT_CMD, 0xB0);
+  outb(PIT_CH2, (PIT_HZ / (1000 / CALIBRATE_MS)) & 0xff);
+  outb(PIT_CH2, (PIT_HZ / (1000 / CALIBRATE_MS)) >> 8);
+  outb(SPEAKER, (inb(SPEAKER) & ~0x02) | 0x01);
+  start = rdtsc();
+
+  // output 2 goes high at the end of the count
+  while (!(inb(SPEAKER) & 0x20))
+    if (++spins == 0x1000000)
+      return;
+  tsc_khz = (u32int)(rdtsc() - start) / CALIBRATE_MS;
+  outb(SPEAKER, inb(SPEAKER) & ~0x01);
+}
+
+/*
+  Procedure..: tsc_ms
+  Description..: Milliseconds between boot and a time stamp.
+      divl keeps this clear of 64 bit division helpers; the
+      quotient fits as long as the uptime is under 49 days.
+*/
+static u32int tsc_ms(u64int tsc)
+{
+  u64int delta = tsc - boot_tsc;
+  u32int q, r;
+
+  if (tsc_khz == 0 || (u32int)(delta >> 32) >= tsc_khz)
+    return 0;
+  asm ("divl %4" : "=a"(q), "=d"(r)
+       : "a"((u32int)delta), "d"((u32int)(delta >> 32)), "rm"(tsc_khz));
+  return q;
+}
+
+void klog(int level, const char *fmt, ...)
+{
+  va_list ap;
+  klog_entry *e;
+  u32int index;
+
+  // claiming the slot is one locked add, so an interrupt
+  // handler logging in the middle just takes the next one
+  index = __sync_fetch_and_add(&next_index, 1);
+  e = &ring[index & KLOG_MASK];
+  e->seq = 0;
+  asm volatile ("" ::: "memory");
+
+  e->level = level < KLOG_DEBUG ? KLOG_DEBUG : level > KLOG_PANIC ? KLOG_PANIC : level;
+  e->tsc = rdtsc();
+  va_start(ap, fmt);
+  vsnprintf(e->msg, KLOG_MSG_SIZE, fmt, ap);
+  va_end(ap);
+
+  asm volatile ("" ::: "memory");
+  e->seq = index + 1;
+
+  // nothing runs the drain before the first dispatch
+  if (cop == NULL)
+    klog_flush(0);
+}
+
+u32int klog_end()
+{
+  return next_index;
+}
+
+u32int klog_start()
+{
+  u32int end = next_index;
+
+  if (end - first_index > KLOG_ENTRIES)
+    return end - KLOG_ENTRIES;
+  return first_index;
+}
+
+int klog_get(u32int index, klog_entry *out)
+{
+  klog_entry *e = &ring[index & KLOG_MASK];
+
+  if (e->seq != index + 1)
+    return 0;
+  *out = *e;
+  asm volatile ("" ::: "memory");
+  // overwritten while it was copied
+  return e->seq == index + 1 && out->seq == index + 1;
+}
+
+void klog_clear()
+{
+  first_index = next_index;
+  if ((int)(drain_index - first_index) < 0)
+    drain_index = first_index;
+}
+
+int klog_format(klog_entry *e, char *buf, int size)
+{
+  u32int ms = tsc_ms(e->tsc);
+
+  return snprintf(buf, size, "[%5u.%03u] %s: %s\r\n", ms / 1000, ms % 1000,
+		  klog_level_name(e->level), e->msg);
+}
+
+int klog_level(const char *name)
+{
+  int i;
+  for (i = 0; i < KLOG_LEVELS; i++)
+    if (strcmp(name, level_names[i]) == 0)
+      return i;
+  return -1;
+}
+
+const char *klog_level_name(int level)
+{
+  if (level < 0 || level >= KLOG_LEVELS)
+    return "?";
+  return level_names[level];
+}
+
+/*
+  Procedure..: klog_next
+  Description..: Finds the next entry for the console, skipping
+      ones that were overwritten before they got there.
+  Returns..: 1 with the entry in e, 0 if none is ready yet
+*/
+static int klog_next(klog_entry *e)
+{
+  u32int start = klog_start();
+
+  if ((int)(drain_index - start) < 0)
+    drain_index = start;
+  while (drain_index != next_index){
+    if (klog_get(drain_index, e))
+      return 1;
+    // still being written
+    if (ring[drain_index & KLOG_MASK].seq == 0)
+      return 0;
+    drain_index++;
+  }
+  return 0;
+}
+
+int klog_drain(int max)
+{
+  char line[KLOG_LINE_SIZE];
+  klog_entry e;
+  int len, stalled = 0;
+
+  if (__sync_lock_test_and_set(&draining, 1))
+    return 1;
+  while (max > 0 && klog_next(&e)){
+    if (e.level >= klog_console_level){
+      len = klog_format(&e, line, sizeof(line));
+      if (len >= (int)sizeof(line))
+	len = sizeof(line) - 1;
+      if (com_is_open(serial_port_out)){
+	// try again next turn rather than wait for the ring
+	if (com_try_write(serial_port_out, line, len) <= 0){
+	  stalled = 1;
+	  break;
+	}
+      }
+      else
+	serial_print(line);
+      max--;
+    }
+    drain_index++;
+  }
+  __sync_lock_release(&draining);
+  // a full ring is not worth spinning on; the THRE interrupt that
+  // empties it wakes the idle process anyway
+  return !stalled && drain_index != next_index;
+}
+
+void klog_flush(int force)
+{
+  char line[KLOG_LINE_SIZE];
+  klog_entry e;
+
+  // a panic may strike while klog_drain holds the flag; it is never
+  // going to finish, so write over it
+  if (__sync_lock_test_and_set(&draining, 1) && !force)
+    return;
+  while (klog_next(&e)){
+    if (e.level >= klog_console_level){
+      klog_format(&e, line, sizeof(line));
+      serial_print(line);
+    }
+    drain_index++;
+  }
+  __sync_lock_release(&draining);
+}
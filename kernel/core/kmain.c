@@ -17,6 +17,9 @@
 #include <core/serial.h>
 #include <core/tables.h>
 #include <core/interrupts.h>
+#include <core/multiboot.h>
+#include <core/klog.h>
+#include <core/trace.h>
 #include <mem/heap.h>
 #include <mem/paging.h>
 #include <modules/mpx_supt.h>
@@ -30,9 +33,7 @@
 void kmain(void)
 {
    extern uint32_t magic;
-   // Uncomment if you want to access the multiboot header
-   // extern void *mbd;
-   // char *boot_loader_name = (char*)((long*)mbd)[16];
+   extern void *mbd;
 
    // ASCII art because we are trying to build a brand
    //mama();
@@ -45,13 +46,24 @@ void kmain(void)
    set_serial_in(COM1);
    set_serial_out(COM1);
 
+   // time stamps for the kernel log
+   klog_init();
+
    // Memory managers have been written and enabled
    mpx_init(MEM_MODULE);
 
-   // Initialize dynamic memory
-   initHeap(50000);
+   // Find out how much RAM there is before anything is sized from it.
+   // The multiboot information is only there when GRUB loaded us
+   detect_memory(magic == MULTIBOOT_BOOT_MAGIC ? mbd : 0);
+
+   // Initialize dynamic memory, 1KB per MB of RAM but no less than before
+   initHeap(mem_size / 1024 > 50000 ? mem_size / 1024 : 50000);
    sys_set_malloc(&allocateMemory);
    sys_set_free(&freeMemory);
+   sys_set_resize(&resizeMemory);
+   sys_set_calloc(&callocateMemory);
+   sys_set_aligned(&allocateAlignedMemory);
+   sys_set_idle(&idleMaintenance);
 
  
    klogv("Starting MPX boot sequence...");
@@ -63,7 +75,7 @@ void kmain(void)
  	
    // 2) Check that the boot was successful and correct when using grub
    // Comment this when booting the kernel directly using QEMU, etc.
-   if ( magic != 0x2BADB002 ){
+   if ( magic != MULTIBOOT_BOOT_MAGIC ){
      //kpanic("Boot was not error free. Halting.");
    }
    
@@ -81,6 +93,10 @@ void kmain(void)
    init_irq();
    sti();
 
+   // Interrupt driven serial I/O. Needs the idt, so it can't be set up with the
+   // memory module above. sys_req hands READ and WRITE to the driver from here on
+   mpx_init(IO_MODULE);
+
    // Initialize PCB queues
    initPCB();
 
@@ -109,6 +125,7 @@ void kmain(void)
    pcb_t * commhandPCB = dispatcher("commhand",&commhand);
    commhandPCB->pcb_priority = 9;
    commhandPCB->pcb_process_class = 0;
+   commhandPCB->pcb_mem_limit = 0; // never starve the shell
    commhandPCB->pcb_process_state = READY;
    insertPCB(commhandPCB);
 
@@ -126,6 +143,7 @@ void kmain(void)
    idlePCB->pcb_process_state = READY;
    idlePCB->pcb_protection_mode = DELETABLE_WHEN_SUSPENDED;
    insertPCB(idlePCB);
+   trace_quiet(idlePCB); // its loop would flood the trace
   
    // yield
    yield();
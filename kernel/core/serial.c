@@ -8,12 +8,26 @@
 #include <string.h>
 #include <core/io.h>
 #include <core/serial.h>
+#include <serial_driver/driver.h>
 #define NO_ERROR 0
 
+#define FIFO_CONTROL 2
+#define LINE_CONTROL 3
+#define LINE_STATUS 5
+#define LCR_DLAB 0x80	// first two registers access the divisor latch
+#define LSR_THRE 0x20	// transmit holding register and FIFO empty
+#define LSR_TEMT 0x40	// shift register empty as well
+#define IIR_FIFO 0xC0	// both bits set when the FIFO is enabled
+
 // Active devices used for serial I/O
 int serial_port_out = 0;
 int serial_port_in = 0;
 
+// Device whose FIFO init_serial managed to enable
+static int tx_fifo_port = 0;
+// Bytes serial_port_out can still take before THRE has to be checked
+static int tx_room = 0;
+
 /*
 	Procedure..: init_serial
 	Description..: Initializes devices for user interaction, logging, ...
@@ -21,15 +35,107 @@ int serial_port_in = 0;
 int init_serial(int device) {
 	outb(device + 1, 0x00);	// disable interrupts
 	outb(device + 3, 0x80);	// set line control register
-	outb(device + 0, 115200 / 9600);	// set bsd least sig bit
-	outb(device + 1, 0x00);	// brd most significant bit
+	outb(device + 0, serial_divisor(9600) & 0xff);	// set bsd least sig bit
+	outb(device + 1, serial_divisor(9600) >> 8);	// brd most significant bit
 	outb(device + 3, 0x03);	// lock divisor; 8bits, no parity, one stop
 	outb(device + 2, 0xC7);	// enable fifo, clear, 14byte threshold
 	outb(device + 4, 0x0B);	// enable interrupts, rts/dsr set
 	(void) inb(device);	// read bit to reset port
+	// an 8250 or 16450 has no fifo and leaves these bits clear
+	if ((inb(device + FIFO_CONTROL) & IIR_FIFO) == IIR_FIFO)
+		tx_fifo_port = device;
+	if (device == serial_port_out)
+		tx_room = 0;
 	return NO_ERROR;
 }
 
+/*
+	Procedure..: serial_tx
+	Description..: Sends one byte on serial_port_out. Waits for THRE
+	only once the FIFO has been filled, then has room for a whole
+	burst of TX_FIFO_SIZE bytes again (one without a FIFO).
+*/
+static void serial_tx(char c) {
+	if (tx_room == 0) {
+		while (!(inb(serial_port_out + LINE_STATUS) & LSR_THRE));
+		tx_room = serial_port_out == tx_fifo_port ? TX_FIFO_SIZE : 1;
+	}
+	outb(serial_port_out, c);
+	tx_room--;
+}
+
+/*
+	Procedure..: serial_tx_begin
+	Description..: Forgets the FIFO room counted so far when the
+	interrupt driver may have been filling the same FIFO.
+*/
+static void serial_tx_begin() {
+	if (com_is_open(serial_port_out))
+		tx_room = 0;
+}
+
+/*
+	Procedure..: serial_divisor
+	Description..: Looks up the divisor latch value for a standard
+	baud rate. Returns 0 for any other rate.
+*/
+int serial_divisor(int baud) {
+	switch (baud) {
+		case 50: case 75: case 110: case 150: case 300: case 600:
+		case 1200: case 1800: case 2400: case 4800: case 9600:
+		case 19200: case 38400: case 57600: case 115200:
+			return 115200 / baud;
+		default:
+			return 0;
+	}
+}
+
+/*
+	Procedure..: set_serial_baud
+	Description..: Reprograms the divisor of a port, keeping its line
+	settings. Waits for the transmitter to drain first so no byte
+	goes out half at the old rate. Returns -1 for an unsupported rate.
+*/
+int set_serial_baud(int device, int baud) {
+	int divisor = serial_divisor(baud);
+	int on = irq_on();
+	u8int lcr;
+
+	if (divisor == 0)
+		return -1;
+	while (!(inb(device + LINE_STATUS) & LSR_TEMT));
+
+	cli();
+	lcr = inb(device + LINE_CONTROL);
+	outb(device + LINE_CONTROL, lcr | LCR_DLAB);
+	outb(device + 0, divisor & 0xff);
+	outb(device + 1, (divisor >> 8) & 0xff);
+	outb(device + LINE_CONTROL, lcr & ~LCR_DLAB);
+	if (on)
+		sti();
+	return NO_ERROR;
+}
+
+/*
+	Procedure..: get_serial_baud
+	Description..: Reads the rate a port is running at back out of
+	its divisor latch.
+*/
+int get_serial_baud(int device) {
+	int divisor;
+	int on = irq_on();
+	u8int lcr;
+
+	cli();
+	lcr = inb(device + LINE_CONTROL);
+	outb(device + LINE_CONTROL, lcr | LCR_DLAB);
+	divisor = inb(device + 0) | (inb(device + 1) << 8);
+	outb(device + LINE_CONTROL, lcr & ~LCR_DLAB);
+	if (on)
+		sti();
+	return divisor ? 115200 / divisor : 0;
+}
+
 /*
   Procedure..: serial_println
   Description..: Writes a message to the active serial output device.
@@ -37,11 +143,12 @@ int init_serial(int device) {
 */
 int serial_println(const char *msg) {
 	int i;
+	serial_tx_begin();
 	for (i = 0; *(i + msg) != '\0'; i++) {
-		outb(serial_port_out, *(i + msg));
+		serial_tx(*(i + msg));
 	}
-	outb(serial_port_out, '\r');
-	outb(serial_port_out, '\n');
+	serial_tx('\r');
+	serial_tx('\n');
 	return NO_ERROR;
 }
 
@@ -51,11 +158,12 @@ int serial_println(const char *msg) {
 */
 int serial_print(const char *msg) {
 	int i;
+	serial_tx_begin();
 	for (i = 0; *(i + msg) != '\0'; i++) {
-		outb(serial_port_out, *(i + msg));
+		serial_tx(*(i + msg));
 	}
 	if (*msg == '\r')
-		outb(serial_port_out, '\n');
+		serial_tx('\n');
 	return NO_ERROR;
 }
 
@@ -67,6 +175,7 @@ int serial_print(const char *msg) {
 */
 int set_serial_out(int device) {
 	serial_port_out = device;
+	tx_room = 0;
 	return NO_ERROR;
 }
 
@@ -93,6 +202,55 @@ int set_serial_in(int device) {
 
 unsigned int consume_special();
 
+/*
+	Procedure..: serial_getc
+	Description..: Fetches the next character typed on COM1. Once the
+	interrupt driver owns the port, characters come from its receive
+	ring. When nothing has been typed the calling process blocks
+	until input arrives, so other processes keep running.
+	Returns 1 if a character was stored in c, 0 otherwise.
+*/
+static int serial_getc(char *c) {
+	int next;
+
+	if (!com_is_open(COM1)) {
+		if (!(inb(COM1 + 5) & 1)) {
+			wait_for_input();
+			return 0;
+		}
+		*c = inb(COM1);
+		return 1;
+	}
+
+	if ((next = com_getc(COM1)) < 0) {
+		wait_for_input();
+		return 0;
+	}
+	*c = next;
+	return 1;
+}
+
+int serial_rx_ready() {
+	if (com_is_open(COM1))
+		return com_rx_pending(COM1);
+	return inb(COM1 + 5) & 1;
+}
+
+/*
+	Procedure..: serial_putc
+	Description..: Echoes a character on COM1. Goes through the
+	driver's transmit ring when it is open so the echo stays in
+	order with output written through sys_req.
+*/
+static void serial_putc(char c) {
+	if (com_is_open(COM1))
+		com_putc(COM1, c);
+	else if (serial_port_out == COM1)
+		serial_tx(c);
+	else
+		outb(COM1, c);
+}
+
 // I made a mess of ur polling function I apologize 
 /* WTF is this Austin!?! Unreadable! jk good job -Maximillian */
 
@@ -114,8 +272,8 @@ int *polling(char *buffer, int *count) {
 
 	/* Driver loop */
 	while (chars_read < *count) {
-		if (inb(COM1 + 5) &1) { /* If there is incoming data */
-			char letter = inb(COM1); /* Holds individual letter */
+		char letter; /* Holds individual letter */
+		if (serial_getc(&letter)) { /* If there is incoming data */
 			int i;
 			switch (letter) {
 				/* Return Key */
@@ -142,15 +300,15 @@ int *polling(char *buffer, int *count) {
 						chars_read--;
 
 						// adjust visually
-						outb(COM1, '\b');
+						serial_putc('\b');
 						for (i = index; i < chars_read; i++) {
 							syntax_handle_char(buffer[i], i);
-							outb(COM1, buffer[i]);
+							serial_putc(buffer[i]);
 						}
-						outb(COM1, ' ');
-						outb(COM1, '\b');
+						serial_putc(' ');
+						serial_putc('\b');
 						for (i = index; i < chars_read; i++)
-							outb(COM1, '\b');
+							serial_putc('\b');
 					}
 					break;
 				/* Special Characters */
@@ -170,12 +328,12 @@ int *polling(char *buffer, int *count) {
 								/* adjust visually */
 								for (i = index; i < chars_read; i++) {
 									syntax_handle_char(buffer[i], i);
-									outb(COM1, buffer[i]);
+									serial_putc(buffer[i]);
 								}
-								outb(COM1, ' ');
-								outb(COM1, '\b');
+								serial_putc(' ');
+								serial_putc('\b');
 								for (i = index; i < chars_read; i++)
-									outb(COM1, '\b');
+									serial_putc('\b');
 							}
 							break;
 						/* Left Arrow */
@@ -183,7 +341,7 @@ int *polling(char *buffer, int *count) {
 							/* Move index to the left if it isn't at the start of the line */
 							if (index > 0) {
 								index--;
-								outb(COM1, '\b');
+								serial_putc('\b');
 							}
 							break;
 						/* Right Arrow */
@@ -191,9 +349,9 @@ int *polling(char *buffer, int *count) {
 							/* Move index to the right if it isn't at the end of the line */
 							if (index < chars_read) {
 								index++;
-								outb(COM1, '\e');
-								outb(COM1, '[');
-								outb(COM1, 'C');
+								serial_putc('\e');
+								serial_putc('[');
+								serial_putc('C');
 							}
 							break;
 						/* History with Up and Down arrow keys */
@@ -212,15 +370,15 @@ int *polling(char *buffer, int *count) {
 						buffer[i] = buffer[i - 1];
 					buffer[index] = letter;
 					syntax_handle_char(letter, index);
-					outb(COM1, letter);
+					serial_putc(letter);
 					chars_read += 1;
 					index += 1;
 					for (i = index; i < chars_read; i++) {
 						syntax_handle_char(buffer[i], i);
-						outb(COM1, buffer[i]);
+						serial_putc(buffer[i]);
 					}
 					for (i = index; i < chars_read; i++)
-						outb(COM1, '\b');
+						serial_putc('\b');
 			}
 		}
 	}
@@ -233,8 +391,8 @@ unsigned int consume_special() {
 
 	int i = 1;
 	while (possibilities != 0) {
-		if (inb(COM1 + 5) &1) {
-			char c = inb(COM1);
+		char c;
+		if (serial_getc(&c)) {
 
 			switch (i) {
 				case 1:
@@ -10,11 +10,28 @@
 
 #include "term/dispatch/context.h"
 
+#include "term/memory_management/mm.h"
+
 #include <lib/out.h>
 
+#include <serial_driver/driver.h>
+
+#include <core/iosched.h>
+
+#include <core/klog.h>
+
+#include <core/trace.h>
+
 /// Currently operating process
 pcb_t * cop;
 
+/// Most processes that can block in wait_for_input at once
+#define MAX_INPUT_WAITERS 8
+
+/// Processes blocked in wait_for_input
+pcb_t * input_waiters[MAX_INPUT_WAITERS];
+int input_waiter_count = 0;
+
 /// Context 
 context * global_context;
 extern pcb_queue_t * priority_queue;
@@ -22,34 +39,99 @@ extern param params;
 
 /*
   Procedure..: klogv
-  Description..: Kernel log messages. Sent to active
+  Description..: Kernel log messages. Recorded in the kernel
+      log, which the idle process writes to the active
       serial device.
 */
 void klogv(const char * msg) {
-    char logmsg[64] = {
-        '\0'
-    }, prefix[] = "klogv: ";
-    strcat(logmsg, prefix);
-    strcat(logmsg, msg);
-    serial_println(logmsg);
+    klog(KLOG_INFO, "%s", msg);
 }
 
 /*
   Procedure..: kpanic
   Description..: Kernel panic. Prints an error message
-      and halts.
+      and everything still waiting in the log, then halts.
 */
 void kpanic(const char * msg) {
     cli(); //disable interrupts
-    char logmsg[64] = {
-        '\0'
-    }, prefix[] = "Panic: ";
-    strcat(logmsg, prefix);
-    strcat(logmsg, msg);
-    klogv(logmsg);
+    klog(KLOG_PANIC, "%s", msg);
+    klog_flush(1);
     hlt(); //halt
 }
 
+void wait_for_input() {
+    // before the first dispatch there is no process to block
+    if (cop == NULL) {
+        if (com_is_open(COM1))
+            com_wait_rx(COM1);
+        return;
+    }
+
+    // no slot left: just yield, the caller tries again when it is next dispatched
+    if (input_waiter_count == MAX_INPUT_WAITERS) {
+        sys_req(IDLE, DEFAULT_DEVICE, NULL, NULL);
+        return;
+    }
+
+    // sys_call puts it back in the ready queue once keys arrive
+    input_waiters[input_waiter_count++] = cop;
+    cop -> pcb_process_state = BLOCKED;
+    sys_req(IDLE, DEFAULT_DEVICE, NULL, NULL);
+}
+
+void cancel_input_wait(pcb_t * pcb) {
+    int i;
+    for (i = 0; i < input_waiter_count; i++) {
+        if (input_waiters[i] == pcb) {
+            input_waiters[i] = input_waiters[--input_waiter_count];
+            return;
+        }
+    }
+}
+
+/**
+ * Checks whether any process in the ready queue can be dispatched.
+ */
+static int anyReady() {
+    pcb_node_t * node;
+    for (node = priority_queue -> pcbq_head; node != NULL; node = node -> pcbn_next_pcb) {
+        if (node -> pcb -> pcb_process_state == READY)
+            return 1;
+    }
+    return 0;
+}
+
+void idle_sleep() {
+    // polled input raises no interrupt that could wake us
+    if (!com_is_open(COM1))
+        return;
+
+    // sti only takes effect after hlt has started, so a key typed
+    // after the check still wakes the cpu
+    cli();
+    if (!anyReady() && !serial_rx_ready())
+        asm volatile ("sti; hlt" ::: "memory");
+    else
+        sti();
+}
+
+/**
+ * Removes the first READY process from the ready queue.
+ * 
+ * @return The process, or NULL if none is READY
+ */
+static pcb_t * nextReady() {
+	pcb_node_t * node = priority_queue -> pcbq_head;
+	while (node != NULL && node -> pcb -> pcb_process_state != READY) {
+		node = node -> pcbn_next_pcb;
+	}
+	if (node == NULL)
+		return NULL;
+	pcb_t * pcb = node -> pcb;
+	removePCB(pcb);
+	return pcb;
+}
+
 /**
  * Called to start interrupt
  * 
@@ -63,15 +145,35 @@ void kpanic(const char * msg) {
 u32int * sys_call(context * registers) {
     pcb_t * pcb = NULL;
 
+    TRACE(TRACE_SYSCALL, params.op_code, 0, cop);
+
+    // bounded slice of heap verification, if enabled
+    checkHeapTick();
+
+    // wake processes whose I/O finished and start the next requests
+    io_complete();
+
+    // wake the processes waiting on the terminal once keys have arrived.
+    // Whoever finds the ring empty again blocks again
+    if (input_waiter_count > 0 && serial_rx_ready()) {
+        while (input_waiter_count > 0) {
+            pcb = input_waiters[--input_waiter_count];
+            // a key that came in before the waiter trapped finds it still
+            // running and in no queue. The IDLE handling below queues it
+            if (pcb != cop)
+                removePCB(pcb);
+            if (pcb -> pcb_process_state == SUSPENDED_BLOCKED)
+                pcb -> pcb_process_state = SUSPENDED_READY;
+            else
+                pcb -> pcb_process_state = READY;
+            if (pcb != cop)
+                insertPCB(pcb);
+            TRACE(TRACE_WAKE, 0, 0, pcb);
+        }
+    }
+
 	// fetch next node to switch to, remove from ready queue
-	pcb_node_t * node = priority_queue -> pcbq_head;
-	while (node != NULL && node -> pcb -> pcb_process_state != READY) {
-		node = node -> pcbn_next_pcb;
-	}
-	if(node != NULL) {
-		pcb = node -> pcb;
-		removePCB(pcb);
-	}
+	pcb = nextReady();
 
     //Is there a currently operating process? 
     if (cop == NULL) {
@@ -84,12 +186,31 @@ u32int * sys_call(context * registers) {
         if (params.op_code == IDLE) {
             // Save the context of cop
             cop -> pcb_stack_top = (unsigned char * ) registers;
-            cop -> pcb_process_state = READY;
+            // a process that blocked itself stays blocked until it is woken
+            if (cop -> pcb_process_state != BLOCKED)
+                cop -> pcb_process_state = READY;
             insertPCB(cop);
+        } else if (params.op_code == READ || params.op_code == WRITE) {
+            cop -> pcb_stack_top = (unsigned char * ) registers;
+            // io_schedule moves it back to the ready queue when done
+            cop -> pcb_process_state = BLOCKED;
+            insertPCB(cop);
+            cop -> pcb_io_status = 0;
+            int status = io_schedule(cop, params.op_code, params.device_id,
+                params.buffer_ptr, params.count_ptr);
+            if (status != 0) {
+                // never queued; sys_req sees why
+                cop -> pcb_io_status = status;
+                removePCB(cop);
+                cop -> pcb_process_state = READY;
+                insertPCB(cop);
+            }
         } else if (params.op_code == EXIT) {
             // Free cop
             cop -> pcb_process_state = SUSPENDED_READY;
             removePCB(cop);
+            // leave the address space before it is released
+            switch_page_dir(kdir);
             freePCB(cop);
 
             // TODO: cop now points to freed memory, 
@@ -104,6 +225,11 @@ u32int * sys_call(context * registers) {
 		//showAll(NULL);
     }
 	//printf("woo\n");
+    // the process that just yielded may be the only one READY
+    if (pcb == NULL) {
+        pcb = nextReady();
+    }
+
     // There is a READY pcb
     if (pcb != NULL) {
 		//printf("woo1\n");
@@ -111,10 +237,19 @@ u32int * sys_call(context * registers) {
 		//p/rintf("woo2\n");
         cop -> pcb_process_state = RUNNING;
 		//printf("woo3\n");
+        // reloading cr3 flushes the TLB; only do it on a real change
+        if (cop -> pcb_page_dir != NULL && cop -> pcb_page_dir != cdir) {
+            switch_page_dir(cop -> pcb_page_dir);
+        }
+        TRACE(TRACE_SWITCH, 0, 0, cop);
         return (u32int * ) cop -> pcb_stack_top;
     }
 	//printf("woo4\n");
 	//printf("about to return\n");
 	//showAll(NULL);
+    if (cdir != kdir) {
+        switch_page_dir(kdir);
+    }
+    TRACE(TRACE_SWITCH, 0, 0, 0);
     return (u32int * ) global_context;
 }
\ No newline at end of file
@@ -0,0 +1,241 @@
+/*
+  ----- trace.c -----
+
+  Description..: Binary event trace. Scheduler, I/O, interrupt
+      and heap events are recorded as fixed size records and sent
+      out on a spare serial port by the idle process. The host
+      decoder in tools/ turns the stream into CSV or Chrome trace
+      JSON.
+*/
+
+#include <system.h>
+#include <string.h>
+
+#include <core/iosched.h>
+#include <core/klog.h>
+#include <core/trace.h>
+#include <modules/mpx_supt.h>
+#include <serial_driver/driver.h>
+
+#include "term/pcb/pcb.h"
+
+#define TRACE_MASK (TRACE_RECORDS - 1)
+// records handed to the driver at once; 4 * 12 bytes fit its ring easily
+#define TRACE_CHUNK 4
+
+extern pcb_t *cop; // running process, defined in system.c
+extern pcb_queue_t *priority_queue, *fifo_queue;
+
+volatile int trace_on = 0;
+
+static trace_rec records[TRACE_RECORDS];
+static u32int head = 0;     // next record to fill
+static u32int tail = 0;     // next record to send
+static u32int taken = 0;
+static u32int lost = 0;     // dropped since the last TRACE_LOST
+static u32int lost_total = 0;
+static u64int last_tsc = 0;
+static int trace_port = 0;
+// port taken from sys_req until the stream on it has drained
+static int claimed_port = 0;
+// the trace port's own interrupts would fill the buffer faster than it drains
+static int skip_irq = -1;
+// process whose IDLE calls are left out, see trace_quiet
+static void *quiet_pcb = NULL;
+// value of the last TRACE_SWITCH; one to the same process is no switch
+static u32int last_switch = 0;
+
+/*
+  Procedure..: put
+  Description..: Appends a record with interrupts already off.
+      A full buffer drops the record and counts it instead.
+*/
+static void put(int event, int aux, int id, u32int delta, u32int value)
+{
+  trace_rec *r;
+
+  if (head - tail >= TRACE_RECORDS){
+    lost++;
+    lost_total++;
+    return;
+  }
+  r = &records[head & TRACE_MASK];
+  r->event = event;
+  r->aux = aux;
+  r->id = id;
+  r->delta = delta;
+  r->value = value;
+  head++;
+  taken++;
+}
+
+/*
+  Procedure..: put_event
+  Description..: Appends a record stamped with the time since the
+      one before it. Interrupts must be off.
+*/
+static void put_event(int event, int aux, int id, u32int value)
+{
+  u64int now = rdtsc();
+  u64int delta = now - last_tsc;
+  u32int need = (delta >> 32) ? 2 : 1;
+
+  // say how much went missing as soon as there is room again
+  if (lost && head - tail + 1 + need <= TRACE_RECORDS){
+    u32int n = lost;
+    lost = 0;
+    put(TRACE_LOST, 0, 0, 0, n);
+  }
+  // a dropped record leaves last_tsc alone, so the next one that
+  // fits carries the time that passed and later stamps stay right
+  if (head - tail + need > TRACE_RECORDS){
+    lost++;
+    lost_total++;
+    return;
+  }
+  if (delta >> 32)
+    put(TRACE_SYNC, 0, 0, 0, (u32int)(delta >> 32));
+  put(event, aux, id, (u32int)delta, value);
+  last_tsc = now;
+}
+
+void trace_event(int event, int aux, int id, u32int value)
+{
+  int on = irq_on();
+
+  if ((event == TRACE_IRQ || event == TRACE_IRQ_END) && aux == skip_irq)
+    return;
+  if (event == TRACE_SYSCALL && aux == IDLE && quiet_pcb != NULL && value == (u32int)quiet_pcb)
+    return;
+  cli();
+  if (event == TRACE_SWITCH && value == last_switch){
+    if (on)
+      sti();
+    return;
+  }
+  if (event == TRACE_SWITCH)
+    last_switch = value;
+  if (trace_on)
+    put_event(event, aux, id, value);
+  if (on)
+    sti();
+}
+
+void trace_name(void *pcb, const char *name)
+{
+  int on = irq_on();
+  u32int chunk;
+  int i, n;
+
+  if (!trace_on)
+    return;
+
+  // the name records must follow their TRACE_PCB directly
+  cli();
+  put_event(TRACE_PCB, 0, 0, (u32int)pcb);
+  n = strlen(name);
+  for (i = 0; i < n; i += 4){
+    memset(&chunk, 0, sizeof(chunk));
+    memcpy(&chunk, name + i, n - i < 4 ? n - i : 4);
+    put(TRACE_NAME, i / 4, 0, 0, chunk);
+  }
+  if (on)
+    sti();
+}
+
+int trace_start(int port)
+{
+  pcb_node_t *node;
+  int rc;
+
+  // a WRITE through sys_req would land in the middle of the stream
+  if (port != claimed_port){
+    if ((rc = io_claim(port)) != 0)
+      return rc;
+    // whatever still waits for the old port is dropped below
+    if (claimed_port != 0)
+      io_release(claimed_port);
+    claimed_port = port;
+  }
+  if ((rc = com_set_baud(port, TRACE_BAUD)) != 0){
+    io_release(port);
+    claimed_port = 0;
+    return rc;
+  }
+
+  cli();
+  trace_port = port;
+  skip_irq = com_irq(port);
+  head = tail = taken = lost = lost_total = 0;
+  last_switch = (u32int)-1;
+  last_tsc = rdtsc();
+  put(TRACE_START, TRACE_VERSION, TRACE_MAGIC, 0, tsc_khz);
+  trace_on = 1;
+  sti();
+
+  // name every process that already exists
+  if (cop != NULL)
+    trace_name(cop, cop->pcb_name);
+  for (node = priority_queue->pcbq_head; node != NULL; node = node->pcbn_next_pcb)
+    trace_name(node->pcb, node->pcb->pcb_name);
+  for (node = fifo_queue->pcbq_head; node != NULL; node = node->pcbn_next_pcb)
+    trace_name(node->pcb, node->pcb->pcb_name);
+  TRACE(TRACE_SWITCH, 0, 0, cop);
+
+  klog(KLOG_INFO, "Tracing to port %x at %i baud", port, TRACE_BAUD);
+  return 0;
+}
+
+void trace_quiet(void *pcb)
+{
+  quiet_pcb = pcb;
+}
+
+void trace_stop()
+{
+  if (!trace_on)
+    return;
+  trace_on = 0;
+  klog(KLOG_INFO, "Tracing stopped after %u records, %u dropped", taken, lost_total);
+}
+
+void trace_drain()
+{
+  u32int n;
+  int rc;
+
+  while (tail != head){
+    // never run past the end of the array in one write
+    n = head - tail;
+    if (n > TRACE_CHUNK)
+      n = TRACE_CHUNK;
+    if (n > TRACE_RECORDS - (tail & TRACE_MASK))
+      n = TRACE_RECORDS - (tail & TRACE_MASK);
+
+    rc = com_try_write(trace_port, (char*)&records[tail & TRACE_MASK], n * sizeof(trace_rec));
+    if (rc < 0){
+      // the port went away; nothing more can be sent
+      tail = head;
+      break;
+    }
+    // the ring is full; the THRE interrupt that empties it wakes
+    // the idle process, so there is no need to spin until then
+    if (rc == 0)
+      return;
+    tail += n;
+  }
+
+  // a stopped stream gives the port back once it is all out
+  if (!trace_on && claimed_port != 0){
+    io_release(claimed_port);
+    claimed_port = 0;
+  }
+}
+
+void trace_stats(int *port, u32int *t, u32int *sent, u32int *l)
+{
+  *port = trace_port;
+  *t = taken;
+  *sent = taken - (head - tail);
+  *l = lost_total;
+}
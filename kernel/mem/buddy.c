@@ -0,0 +1,166 @@
+/*
+  ----- buddy.c -----
+
+  Description..: Binary buddy allocator for page-granular kernel
+    allocations (page tables, stacks, device buffers). The pool is
+    a run of frames reserved from the frame bitmap in paging.c and
+    identity mapped, so free blocks can hold their own list links.
+    Splitting and merging touch at most BUDDY_MAX_ORDER levels.
+*/
+
+#include <system.h>
+#include <string.h>
+
+#include "mem/paging.h"
+#include "mem/buddy.h"
+
+// per-page state; only meaningful for the first page of a block
+#define BLOCK_FREE  0x80
+#define BLOCK_USED  0x40
+#define ORDER_MASK  0x1F
+
+/* Free block list node, stored in the free block itself */
+typedef struct free_block {
+  struct free_block *next;
+  struct free_block *prev;
+} free_block;
+
+static free_block *free_lists[BUDDY_MAX_ORDER+1];
+static u8int block_state[BUDDY_POOL_PAGES];
+static u32int pool_base  = 0;
+static u32int pool_pages = 0;
+
+static void push_block(u32int idx, u32int order)
+{
+  free_block *b = (free_block*)(pool_base + idx*PAGE_SIZE);
+  b->prev = 0;
+  b->next = free_lists[order];
+  if (b->next) b->next->prev = b;
+  free_lists[order] = b;
+  block_state[idx] = BLOCK_FREE | order;
+}
+
+static void unlink_block(u32int idx, u32int order)
+{
+  free_block *b = (free_block*)(pool_base + idx*PAGE_SIZE);
+  if (b->prev) b->prev->next = b->next;
+  else free_lists[order] = b->next;
+  if (b->next) b->next->prev = b->prev;
+  block_state[idx] = 0;
+}
+
+/*
+  Procedure..: init_buddy
+  Description..: Hands a physically contiguous, identity mapped
+    run of frames to the buddy allocator.
+*/
+void init_buddy(u32int base, u32int npages)
+{
+  u32int idx, order;
+
+  if (npages > BUDDY_POOL_PAGES) npages = BUDDY_POOL_PAGES;
+  pool_base  = base;
+  pool_pages = npages;
+  memset(free_lists, 0, sizeof(free_lists));
+  memset(block_state, 0, sizeof(block_state));
+
+  //carve the pool into the largest naturally aligned blocks that fit
+  idx = 0;
+  while (idx < npages){
+    order = BUDDY_MAX_ORDER;
+    while ((idx & ((1 << order) - 1)) || idx + (1 << order) > npages)
+      order--;
+    push_block(idx, order);
+    idx += 1 << order;
+  }
+}
+
+/*
+  Procedure..: alloc_pages
+  Description..: Allocates a run of 2^order contiguous pages.
+*/
+u32int alloc_pages(u32int order)
+{
+  u32int k, idx;
+
+  if (order > BUDDY_MAX_ORDER) return 0;
+
+  //smallest non-empty list that can satisfy the request
+  for (k=order; k<=BUDDY_MAX_ORDER && !free_lists[k]; k++);
+  if (k > BUDDY_MAX_ORDER) return 0;
+
+  idx = ((u32int)free_lists[k] - pool_base) / PAGE_SIZE;
+  unlink_block(idx, k);
+
+  //split, returning the upper halves to the free lists
+  while (k > order){
+    k--;
+    push_block(idx + (1 << k), k);
+  }
+
+  block_state[idx] = BLOCK_USED | order;
+  return pool_base + idx*PAGE_SIZE;
+}
+
+/*
+  Procedure..: free_pages
+  Description..: Returns a block obtained from alloc_pages and merges
+      it with its buddy while the buddy is free and of the same order.
+*/
+int free_pages(u32int addr)
+{
+  u32int idx, order, buddy;
+
+  if (!buddy_owns(addr) || (addr & (PAGE_SIZE-1))) return -1;
+  idx = (addr - pool_base) / PAGE_SIZE;
+  if (!(block_state[idx] & BLOCK_USED)) return -1;
+  order = block_state[idx] & ORDER_MASK;
+  block_state[idx] = 0;
+
+  while (order < BUDDY_MAX_ORDER){
+    buddy = idx ^ (1 << order);
+    if (buddy >= pool_pages || block_state[buddy] != (BLOCK_FREE | order))
+      break;
+    unlink_block(buddy, order);
+    if (buddy < idx) idx = buddy;
+    order++;
+  }
+
+  push_block(idx, order);
+  return 0;
+}
+
+/*
+  Procedure..: buddy_block_size
+  Description..: Size in bytes of an allocated block.
+*/
+u32int buddy_block_size(u32int addr)
+{
+  u32int idx;
+
+  if (!buddy_owns(addr) || (addr & (PAGE_SIZE-1))) return 0;
+  idx = (addr - pool_base) / PAGE_SIZE;
+  if (!(block_state[idx] & BLOCK_USED)) return 0;
+  return PAGE_SIZE << (block_state[idx] & ORDER_MASK);
+}
+
+/*
+  Procedure..: buddy_owns
+  Description..: Checks if an address lies inside the buddy pool.
+*/
+int buddy_owns(u32int addr)
+{
+  return pool_pages && addr >= pool_base
+    && addr < pool_base + pool_pages*PAGE_SIZE;
+}
+
+/*
+  Procedure..: pages_to_order
+  Description..: Smallest order whose block holds npages pages.
+*/
+u32int pages_to_order(u32int npages)
+{
+  u32int order = 0;
+  while ((u32int)(1 << order) < npages) order++;
+  return order;
+}
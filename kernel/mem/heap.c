@@ -7,12 +7,18 @@
 #include <system.h>
 #include <string.h>
 
-#include <core/serial.h>
+#include <core/klog.h>
+#include <mem/buddy.h>
 #include <mem/heap.h>
 #include <mem/paging.h>
 
+// smallest payload worth splitting a hole for
+#define MIN_SPLIT 16
+#define BLOCK_OVERHEAD (sizeof(header) + sizeof(footer))
+
 heap* kheap = 0; //kernel heap
 heap* curr_heap = 0; //current heap
+u32int kheap_size = KHEAP_SIZE; //max kernel heap size, scaled to RAM at boot
 
 extern page_dir *kdir; //kernel page directory
 extern void* end, _end, __end; //kernel end; defined in link.ld
@@ -27,9 +33,19 @@ u32int _kmalloc(u32int size, int page_align, u32int *phys_addr)
 
   // Allocate on the kernel heap if one has been created
   if (kheap != 0){
+    //heap pages get their frames one by one, so anything that may
+    //cross a page boundary comes from the buddy pool, which is
+    //physically contiguous and identity mapped. Release it with
+    //free_pages
+    if (phys_addr && (size > PAGE_SIZE || !page_align)){
+      addr = (u32int*)alloc_pages(pages_to_order((size + PAGE_SIZE - 1) / PAGE_SIZE));
+      if (addr)
+	*phys_addr = (u32int)addr;
+      return (u32int)addr;
+    }
     addr = (u32int*)alloc(size, kheap, page_align);
-    if (phys_addr){
-      page_entry *page = get_page((u32int)addr, kdir, 0);
+    if (addr && phys_addr){
+      page_entry *page = get_page((u32int)addr, kdir, 1);
       *phys_addr = (page->frameaddr*0x1000) + ((u32int)addr & 0xFFF);
     }
     return (u32int)addr;
@@ -54,22 +70,235 @@ u32int kmalloc(u32int size)
   return _kmalloc(size,0,0);
 }
 
+/*
+  Procedure..: new_entry
+  Description..: Finds an unused slot in the heap's index table.
+      Returns -1 when the table is full.
+*/
+#define VALID_ID(h, n) ((n) >= 0 && (n) < (h)->index.id)
+
+static int new_entry(heap *h)
+{
+  int i;
+  for (i=0; i<h->index.id; i++)
+    if (h->index.table[i].size == 0)
+      return i;
+  if (h->index.id >= TABLE_SIZE)
+    return -1;
+  return h->index.id++;
+}
+
+/*
+  Procedure..: write_block
+  Description..: Writes the header, footer and index entry
+      describing one block.
+*/
+static void write_block(heap *h, u32int addr, int size, int empty, int id)
+{
+  header *head = (header*)addr;
+  footer *foot = (footer*)(addr + size - sizeof(footer));
+
+  head->size = size;
+  head->index_id = id;
+  foot->head = *head;
+
+  h->index.table[id].size  = size;
+  h->index.table[id].empty = empty;
+  h->index.table[id].block = addr;
+}
+
+/*
+  Procedure..: expand
+  Description..: Maps more pages at the end of the heap so that
+      at least size more bytes are available. The new space joins
+      the last block if it is a hole. Returns 0 if the heap would
+      grow past its max size or the index table is full.
+*/
+static int expand(heap *h, u32int size)
+{
+  u32int new_end = (h->end + size + PAGE_SIZE - 1) & 0xFFFFF000;
+  u32int addr;
+  footer *last;
+  int id;
+
+  if (new_end > h->base + h->max_size)
+    return 0;
+
+  //back the new pages now. Process stacks are carved out of the
+  //heap and processes run at ring 0 without a stack switch, so a
+  //fault on a missing stack page could not push its frame
+  for (addr=h->end; addr<new_end; addr+=PAGE_SIZE)
+    new_frame(get_page(addr, kdir, 1));
+
+  last = (footer*)(h->end - sizeof(footer));
+  if (h->end > h->start && VALID_ID(h, last->head.index_id)
+      && h->index.table[last->head.index_id].empty
+      && h->index.table[last->head.index_id].block + last->head.size == h->end){
+    id = last->head.index_id;
+    addr = h->index.table[id].block;
+  }
+  else {
+    if ((id = new_entry(h)) < 0)
+      return 0;
+    addr = h->end;
+  }
+
+  h->end = new_end;
+  write_block(h, addr, new_end - addr, 1, id);
+  return 1;
+}
+
 u32int alloc(u32int size, heap *h, int align)
 {
-  no_warn(size||align||h);
-  static u32int heap_addr = KHEAP_BASE;
+  return alloc_aligned(size, h, align ? PAGE_SIZE : 4);
+}
+
+u32int alloc_aligned(u32int size, heap *h, u32int alignment)
+{
+  u32int need, addr, pad = 0;
+  int i, id;
 
-  u32int base = heap_addr;
-  heap_addr += size;
+  if (h == 0 || size == 0 || (alignment & (alignment - 1)))
+    return 0;
+  if (alignment < 4)
+    alignment = 4;
 
-  if (heap_addr > KHEAP_BASE + KHEAP_MIN)
-    serial_println("Heap is full!");
+  size = (size + 3) & ~3;
+  need = size + BLOCK_OVERHEAD;
+
+  while (1){
+    //first hole that fits, including any alignment padding
+    for (i=0; i<h->index.id; i++){
+      index_entry *e = &h->index.table[i];
+      if (e->size == 0 || !e->empty)
+	continue;
+      pad = (alignment - ((e->block + sizeof(header)) & (alignment - 1))) & (alignment - 1);
+      //the leading hole must be able to hold its own header/footer
+      while (pad && pad < BLOCK_OVERHEAD + MIN_SPLIT)
+	pad += alignment;
+      if ((u32int)e->size >= pad + need)
+	break;
+    }
+    if (i < h->index.id)
+      break;
 
-  return base;
+    if (!expand(h, need + (alignment > 4 ? alignment + BLOCK_OVERHEAD + MIN_SPLIT : 0))){
+      klog(KLOG_ERR, "Heap is full!");
+      return 0;
+    }
+  }
+
+  addr = h->index.table[i].block;
+  size = h->index.table[i].size;
+
+  //split off the alignment padding as its own hole
+  if (pad){
+    if ((id = new_entry(h)) < 0)
+      return 0;
+    write_block(h, addr, pad, 1, i);
+    i = id;
+    addr += pad;
+    size -= pad;
+  }
+
+  //return whatever is left over past the request to the heap
+  if (size - need >= BLOCK_OVERHEAD + MIN_SPLIT && (id = new_entry(h)) >= 0){
+    write_block(h, addr + need, size - need, 1, id);
+    size = need;
+  }
+
+  write_block(h, addr, size, 0, i);
+  return addr + sizeof(header);
+}
+
+u32int ksize(u32int addr)
+{
+  heap *h = kheap;
+  header *head;
+  index_entry *e;
+
+  if (h == 0 || addr < h->start + sizeof(header) || addr >= h->end)
+    return 0;
+
+  head = (header*)(addr - sizeof(header));
+  if (!VALID_ID(h, head->index_id))
+    return 0;
+  e = &h->index.table[head->index_id];
+  if (e->block != (u32int)head || e->empty)
+    return 0;
+  return e->size - BLOCK_OVERHEAD;
+}
+
+int kfree(u32int addr)
+{
+  heap *h = kheap;
+  header *head, *next;
+  footer *prev;
+  index_entry *e, *n, *p;
+  u32int block;
+  int id;
+
+  if (h == 0 || addr < h->start + sizeof(header) || addr >= h->end)
+    return -1;
+
+  head = (header*)(addr - sizeof(header));
+  if (!VALID_ID(h, head->index_id))
+    return -1;
+  e = &h->index.table[head->index_id];
+  if (e->block != (u32int)head || e->empty)
+    return -1;
+
+  block = e->block;
+  id = head->index_id;
+  e->empty = 1;
+
+  //merge with the block to the right
+  if (block + e->size < h->end){
+    next = (header*)(block + e->size);
+    n = &h->index.table[next->index_id];
+    if (VALID_ID(h, next->index_id) && n->block == (u32int)next && n->empty){
+      e->size += n->size;
+      n->size = 0;
+    }
+  }
+
+  //merge with the block to the left
+  if (block > h->start){
+    prev = (footer*)(block - sizeof(footer));
+    p = &h->index.table[prev->head.index_id];
+    if (VALID_ID(h, prev->head.index_id) && p->block == block - prev->head.size
+	&& p->empty){
+      p->size += e->size;
+      e->size = 0;
+      block = p->block;
+      id = prev->head.index_id;
+    }
+  }
+
+  write_block(h, block, h->index.table[id].size, 1, id);
+  return 0;
 }
 
 heap* make_heap(u32int base, u32int max, u32int min)
-{  
-  no_warn(base||max||min);
-  return (heap*)kmalloc(sizeof(heap));
+{
+  heap *h = (heap*)base;
+  int id;
+
+  memset(h, 0, sizeof(heap));
+  h->base = base;
+  h->max_size = max;
+  h->min_size = min;
+  h->start = (base + sizeof(heap) + 7) & ~7;
+  h->end = base + min;
+
+  //the rest of the initial area is one big hole
+  id = new_entry(h);
+  write_block(h, h->start, h->end - h->start, 1, id);
+  return h;
+}
+
+void init_kheap()
+{
+  kheap = make_heap(KHEAP_BASE, kheap_size, KHEAP_MIN);
+  curr_heap = kheap;
 }
@@ -11,12 +11,25 @@
 
 #include "mem/heap.h"
 #include "mem/paging.h"
+#include "mem/buddy.h"
+#include "core/multiboot.h"
 
-u32int mem_size  = 0x4000000; //64MB
+u32int mem_size  = DEFAULT_MEM_SIZE; //set from the memory map by detect_memory
 u32int page_size = 0x1000; //4KB
 
 u32int nframes; //number of frames
 u32int *frames; //bitmap of frames
+u16int *frame_refs; //extra copy-on-write mappings per frame
+
+//summary level over the frame bitmap: bit w is set when
+//frames[w] is full, so a free frame is two bit scans away
+u32int nwords;       //number of words in the frame bitmap
+u32int *frames_full; //bitmap of full frame bitmap words
+
+//recently freed frames; handed out again before scanning
+#define FREE_STACK_SIZE 64
+u32int free_stack[FREE_STACK_SIZE];
+int free_top = 0;
 
 page_dir *kdir = 0; //kernel directory
 page_dir *cdir = 0; //current directory
@@ -25,6 +38,80 @@ page_dir *cdir = 0; //current directory
 extern u32int phys_alloc_addr;
 extern heap* kheap;
 
+//set once the buddy pool exists; page tables come from it afterwards
+int buddy_ready = 0;
+
+//set when the identity mapping uses 4MB pages
+int pse = 0;
+
+//usable physical memory, from the boot loader's memory map
+#define MAX_MEM_RANGES 32
+typedef struct {
+  u32int start;
+  u32int end;
+} mem_range;
+mem_range mem_ranges[MAX_MEM_RANGES];
+int nmem_ranges = 0;
+
+//demand-zero regions; looked up on every not present fault
+region regions[MAX_REGIONS];
+int nregions = 0;
+
+/*
+  Procedure..: cpu_has_pse
+  Description..: Checks cpuid for page size extension support.
+*/
+static int cpu_has_pse()
+{
+  u32int eax = 1, ebx, ecx, edx;
+  asm volatile ("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+  no_warn(ebx||ecx);
+  return (edx >> 3) & 1;
+}
+
+/*
+  Procedure..: map_large
+  Description..: Maps a 4MB page directly in the page directory.
+    Both addresses must be 4MB aligned.
+*/
+static void map_large(page_dir *dir, u32int virt, u32int phys)
+{
+  u32int index = virt / LARGE_PAGE_SIZE;
+  dir->tables[index] = 0;
+  dir->tables_phys[index] = phys | PDE_LARGE | PDE_WRITEABLE | PDE_PRESENT;
+}
+
+/*
+  Procedure..: invlpg
+  Description..: Drops a single page from the TLB.
+*/
+static inline void invlpg(u32int addr)
+{
+  asm volatile ("invlpg (%0)" :: "r"(addr) : "memory");
+}
+
+/*
+  Procedure..: private_index
+  Description..: Checks if a directory index belongs to the
+    per-process part of the address space.
+*/
+static inline int private_index(u32int index)
+{
+  return index >= PROC_SPACE_BASE/LARGE_PAGE_SIZE
+    && index < PROC_SPACE_END/LARGE_PAGE_SIZE;
+}
+
+/*
+  Procedure..: bsf
+  Description..: Index of the lowest set bit. x must not be 0.
+*/
+static inline u32int bsf(u32int x)
+{
+  u32int r;
+  asm ("bsf %1,%0" : "=r"(r) : "rm"(x));
+  return r;
+}
+
 /*
   Procedure..: set_bit
   Description..: Marks a page frame bit as in use (1).
@@ -35,6 +122,8 @@ void set_bit(u32int addr)
   u32int index  = frame/32;
   u32int offset = frame%32;
   frames[index] |= (1 << offset);
+  if (frames[index] == 0xFFFFFFFF)
+    frames_full[index/32] |= (1 << (index%32));
 }
 
 /*
@@ -47,6 +136,7 @@ void clear_bit(u32int addr)
   u32int index  = frame/32;
   u32int offset = frame%32;
   frames[index] &= ~(1 << offset);
+  frames_full[index/32] &= ~(1 << (index%32));
 }
 
 /*
@@ -63,75 +153,288 @@ u32int get_bit(u32int addr)
 
 /*
   Procedure..: find_free
-  Description..: Finds the first free page frame.
+  Description..: Finds a free page frame. Recently freed frames
+    are reused first; otherwise the summary bitmap leads straight
+    to a bitmap word with a free bit.
 */
 u32int find_free()
 {
-  u32int i,j;
-  for (i=0; i<nframes/32; i++)
-    if (frames[i] != 0xFFFFFFFF) //if frame not full
-      for (j=0; j<32; j++) //find first free bit
-	if (!(frames[i] & (1 << j)))
-	  return i*32+j;
+  u32int i,w;
+
+  while (free_top > 0){
+    i = free_stack[--free_top];
+    if (!get_bit(i*page_size))
+      return i;
+  }
+
+  for (i=0; i<(nwords+31)/32; i++)
+    if (frames_full[i] != 0xFFFFFFFF){
+      w = i*32 + bsf(~frames_full[i]);
+      return w*32 + bsf(~frames[w]);
+    }
 
   return -1; //no free frames
 }
 
+/*
+  Procedure..: refill_frame_cache
+  Description..: Scans a few bitmap words from where the last call
+    stopped and pushes their free frames onto the free stack. A
+    frame may end up on the stack twice; find_free skips the copy
+    once the frame is in use.
+*/
+#define REFILL_WORDS 4
+static u32int refill_word = 0;
+
+void refill_frame_cache()
+{
+  u32int n, bits;
+
+  for (n=0; n<REFILL_WORDS && free_top < FREE_STACK_SIZE; n++){
+    if (refill_word >= nwords) refill_word = 0;
+    bits = ~frames[refill_word];
+    while (bits && free_top < FREE_STACK_SIZE){
+      free_stack[free_top++] = refill_word*32 + bsf(bits);
+      bits &= bits - 1;
+    }
+    refill_word++;
+  }
+}
+
+/*
+  Procedure..: add_mem_range
+  Description..: Records a range of usable RAM, trimmed to whole
+    pages below 4GB.
+*/
+static void add_mem_range(u32int base, u32int len_low, u32int len_high)
+{
+  u32int start = (base + PAGE_SIZE - 1) & 0xFFFFF000;
+  u32int end = base + len_low;
+
+  //ranges reaching past 4GB are cut at the last page
+  if (len_high || end < base)
+    end = 0xFFFFF000;
+  end &= 0xFFFFF000;
+
+  if (start >= end || start < base || nmem_ranges >= MAX_MEM_RANGES)
+    return;
+  mem_ranges[nmem_ranges].start = start;
+  mem_ranges[nmem_ranges].end = end;
+  nmem_ranges++;
+}
+
+/*
+  Procedure..: detect_memory
+  Description..: Reads the usable RAM ranges from the multiboot
+    memory map, falling back to the basic lower/upper sizes and
+    then to DEFAULT_MEM_SIZE. Sets mem_size to the end of the
+    highest range and scales the kernel heap limit to it.
+*/
+void detect_memory(void *mbd)
+{
+  multiboot_info *mbi = (multiboot_info*)mbd;
+  multiboot_mmap_entry *entry;
+  u32int addr, end;
+  int i;
+
+  nmem_ranges = 0;
+  if (mbi && (mbi->flags & MULTIBOOT_INFO_MEM_MAP)){
+    addr = mbi->mmap_addr;
+    end = addr + mbi->mmap_length;
+    while (addr < end){
+      entry = (multiboot_mmap_entry*)addr;
+      if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && entry->base_high == 0)
+        add_mem_range(entry->base_low, entry->length_low, entry->length_high);
+      addr += entry->size + 4;
+    }
+  }
+  else if (mbi && (mbi->flags & MULTIBOOT_INFO_MEMORY)){
+    add_mem_range(0, mbi->mem_lower*1024, 0);
+    add_mem_range(0x100000, mbi->mem_upper*1024, 0);
+  }
+  if (nmem_ranges == 0){
+    //nothing from the boot loader; assume a standard pc layout
+    add_mem_range(0, 0xA0000, 0);
+    add_mem_range(0x100000, DEFAULT_MEM_SIZE - 0x100000, 0);
+  }
+
+  mem_size = 0;
+  for (i=0; i<nmem_ranges; i++)
+    if (mem_ranges[i].end > mem_size)
+      mem_size = mem_ranges[i].end;
+
+  //a quarter of RAM, in whole page tables
+  kheap_size = (mem_size/4) & ~(LARGE_PAGE_SIZE-1);
+  if (kheap_size < LARGE_PAGE_SIZE) kheap_size = LARGE_PAGE_SIZE;
+  if (kheap_size > KHEAP_MAX_SIZE) kheap_size = KHEAP_MAX_SIZE;
+}
+
+/*
+  Procedure..: init_frames
+  Description..: Allocates the frame bitmap and its summary
+    level. Only frames inside the usable RAM ranges start out
+    free; holes and bits past the last frame are marked as in
+    use so they are never handed out.
+*/
+static void init_frames()
+{
+  u32int i, nsummary;
+  int r;
+
+  nframes = (u32int)(mem_size/page_size);
+  nwords = (nframes+31)/32;
+  nsummary = (nwords+31)/32;
+  frames = (u32int*)kmalloc(nwords*4);
+  memset(frames, 0xFF, nwords*4);
+  frames_full = (u32int*)kmalloc(nsummary*4);
+  memset(frames_full, 0xFF, nsummary*4);
+  frame_refs = (u16int*)kmalloc(nframes*sizeof(u16int));
+  memset(frame_refs, 0, nframes*sizeof(u16int));
+
+  for (r=0; r<nmem_ranges; r++)
+    for (i=mem_ranges[r].start; i<mem_ranges[r].end; i+=page_size)
+      clear_bit(i);
+  free_top = 0;
+}
+
 /*
   Procedure..: get_page
   Description..: Finds and returns a page, allocating a new 
-   page table if necessary.
+   page table if necessary. Returns 0 for addresses covered
+   by a 4MB page. Kernel tables of other directories are
+   made in the kernel directory so every space shares them.
 */
 page_entry* get_page(u32int addr, page_dir *dir, int make_table)
 {
   u32int phys_addr;
   u32int index = addr / page_size / 1024;
   u32int offset = addr / page_size % 1024;
+  page_entry *page;
+
+  if (dir != kdir && kdir && !private_index(index) && !dir->tables[index]){
+    page = get_page(addr, kdir, make_table);
+    dir->tables[index] = kdir->tables[index];
+    dir->tables_phys[index] = kdir->tables_phys[index];
+    return page;
+  }
   
   //return it if it exists
   if (dir->tables[index])
     return &dir->tables[index]->pages[offset];
+
+  //4MB pages have no page table to hand out
+  else if (dir->tables_phys[index] & PDE_LARGE)
+    return 0;
   
   //create it
   else if (make_table){
-    dir->tables[index] = (page_table*)_kmalloc(sizeof(page_table), 1, &phys_addr);
+    if (buddy_ready && (phys_addr = alloc_pages(0)) != 0){
+      //the buddy pool is identity mapped
+      memset((void*)phys_addr, 0, sizeof(page_table));
+      dir->tables[index] = (page_table*)phys_addr;
+    }
+    else
+      dir->tables[index] = (page_table*)_kmalloc(sizeof(page_table), 1, &phys_addr);
     dir->tables_phys[index] = phys_addr | 0x7; //enable present, writable
     return &dir->tables[index]->pages[offset];
   }
   else return 0;
 }
 
+/*
+  Procedure..: identity_map
+  Description..: Maps the kernel page at addr onto the frame
+    with the same address. The frame bitmap is left alone.
+*/
+static void identity_map(u32int addr)
+{
+  page_entry *page = get_page(addr,kdir,1);
+  page->present   = 1;
+  page->writeable = 1;
+  page->usermode  = 0;
+  page->frameaddr = addr/page_size;
+}
+
 /*
   Procedure..: init_paging
   Description..: Initializes the kernel page directory and 
     initial kernel heap area. Performs identity mapping of
     the kernel frames such that the virtual addresses are
-    equivalent to the physical addresses.
+    equivalent to the physical addresses, using 4MB pages
+    when the cpu supports them.
 */
 void init_paging()
 {
+  u32int i, pool, npool;
+
   //create frame bitmap
-  nframes = (u32int)(mem_size/page_size);
-  frames = (u32int*)kmalloc(nframes/32);
-  memset(frames, 0, nframes/32);
+  init_frames();
 
   //create kernel directory
   kdir = (page_dir*)_kmalloc(sizeof(page_dir), 1, 0); //page aligned
   memset(kdir, 0, sizeof(page_dir));
 
-  //get pages for kernel heap
-  u32int i = 0x0;
-  for(i=KHEAP_BASE; i<(KHEAP_BASE+KHEAP_MIN); i+=1){
+  //identity map with 4MB pages when the cpu supports them
+  pse = cpu_has_pse();
+
+  //get page tables for the whole kernel heap and the scratch
+  //page up front, so directories cloned later share them
+  for(i=KHEAP_BASE; i<(KHEAP_BASE+kheap_size); i+=PAGE_SIZE*1024){
     get_page(i,kdir,1);
   }
+  get_page(SCRATCH_PAGE,kdir,1);
+
+  //the buddy pool starts on the first pool-aligned boundary past the
+  //kernel. Without large pages, create its page tables before the
+  //identity mapping so they are identity mapped too
+  pool = (phys_alloc_addr + 0x10000 + BUDDY_POOL_SIZE - 1) & ~(BUDDY_POOL_SIZE - 1);
+  if (!pse){
+    for(i=pool; i<pool+BUDDY_POOL_SIZE; i+=PAGE_SIZE*1024){
+      get_page(i,kdir,1);
+    }
+  }
 
   //perform identity mapping of used memory
-  //note: placement_addr gets incremented in get_page,
-  //so we're mapping the first frames as well
-  i = 0x0;
-  while (i < (phys_alloc_addr+0x10000)){
-    new_frame(get_page(i,kdir,1));
-    i += page_size;
+  if (pse){
+    //large pages need no page tables, so the placement
+    //address no longer moves while we map
+    for(i=0; i<phys_alloc_addr+0x10000; i+=PAGE_SIZE){
+      if (i < mem_size) set_bit(i);
+    }
+    for(i=0; i<pool; i+=LARGE_PAGE_SIZE){
+      map_large(kdir, i, i);
+    }
+  }
+  else {
+    //note: placement_addr gets incremented in get_page,
+    //so we're mapping the first frames as well. Frames are
+    //mapped by address rather than taken from the bitmap, as
+    //holes such as video memory are already marked as used
+    i = 0x0;
+    while (i < (phys_alloc_addr+0x10000)){
+      if (i < mem_size) set_bit(i);
+      identity_map(i);
+      i += page_size;
+    }
+    if (i > pool) kpanic("Buddy pool overlaps the kernel");
+  }
+
+  //the pool only gets the free frames it starts with, in case
+  //RAM ends or a hole begins inside it
+  for(npool=0; npool<BUDDY_POOL_PAGES; npool++){
+    i = pool + npool*PAGE_SIZE;
+    if (i >= mem_size || get_bit(i)) break;
+  }
+
+  //identity map the buddy pool and take its frames out of the bitmap
+  for(i=pool; i<pool+BUDDY_POOL_SIZE; i+=PAGE_SIZE){
+    if (i < mem_size && i < pool + npool*PAGE_SIZE) set_bit(i);
+    if (!pse) identity_map(i);
+  }
+  if (pse){
+    for(i=pool; i<pool+BUDDY_POOL_SIZE; i+=LARGE_PAGE_SIZE){
+      map_large(kdir, i, i);
+    }
   }
 
   //allocate heap frames now that the placement addr has increased.
@@ -143,8 +446,16 @@ void init_paging()
   //load the kernel page directory; enable paging
   load_page_dir(kdir);
 
+  //page-granular allocations are served by the buddy pool from here on
+  init_buddy(pool, npool);
+  buddy_ready = 1;
+
+  //the heap is not a demand-zero region: process stacks live in it,
+  //and a fault on a stack page at ring 0 cannot push its frame.
+  //expand() backs heap pages as it maps them
+
   //setup the kernel heap
-  kheap = make_heap(KHEAP_BASE, KHEAP_SIZE, KHEAP_BASE+KHEAP_MIN);
+  init_kheap();
 }
 
 /*
@@ -158,10 +469,17 @@ void init_paging()
 void load_page_dir(page_dir *new_dir)
 {
   cdir = new_dir;
+  if (pse){
+    u32int cr4;
+    asm volatile ("mov %%cr4,%0": "=b"(cr4));
+    cr4 |= 0x10; //page size extensions
+    asm volatile ("mov %0,%%cr4":: "b"(cr4));
+  }
   asm volatile ("mov %0,%%cr3":: "b"(&cdir->tables_phys[0]));
   u32int cr0;
   asm volatile ("mov %%cr0,%0": "=b"(cr0));
   cr0 |= 0x80000000;
+  cr0 |= 0x10000; //write protect: ring 0 faults on read-only (cow) pages
   asm volatile ("mov %0,%%cr0":: "b"(cr0));
 }
 
@@ -183,3 +501,237 @@ void new_frame(page_entry *page)
   page->writeable = 1;
   page->usermode  = 0;
 }
+
+/*
+  Procedure..: free_frame
+  Description..: Releases the frame backing a page and
+    clears the page. The frame is cached for the next new_frame.
+    A frame still shared copy-on-write only loses one reference.
+*/
+void free_frame(page_entry *page)
+{
+  u32int index = page->frameaddr;
+  if (!page->present && index == 0) return;
+
+  if (frame_refs[index] > 0)
+    frame_refs[index]--;
+  else {
+    clear_bit(index*page_size);
+    if (free_top < FREE_STACK_SIZE)
+      free_stack[free_top++] = index;
+  }
+  page->present   = 0;
+  page->frameaddr = 0;
+  page->cow       = 0;
+}
+
+/*
+  Procedure..: switch_page_dir
+  Description..: Makes a page directory the current one by
+    loading cr3. Loading cr3 flushes the TLB, so callers
+    should skip it when the directory does not change.
+*/
+void switch_page_dir(page_dir *dir)
+{
+  cdir = dir;
+  asm volatile ("mov %0,%%cr3":: "r"(&dir->tables_phys[0]));
+}
+
+/*
+  Procedure..: map_cow
+  Description..: Shares the frame at src_addr in src with dst at
+    dst_addr. Writable pages become read-only copy-on-write pages
+    in both directories.
+*/
+int map_cow(page_dir *dst, u32int dst_addr, page_dir *src, u32int src_addr)
+{
+  page_entry *s = get_page(src_addr, src, 0);
+  page_entry *d;
+
+  if (!s || !s->present) return -1;
+  if ((d = get_page(dst_addr, dst, 1)) == 0) return -1;
+  if (d->present) free_frame(d);
+
+  if (s->writeable || s->cow){
+    s->writeable = 0;
+    s->cow = 1;
+    if (src == cdir) invlpg(src_addr);
+  }
+  *d = *s;
+  frame_refs[s->frameaddr]++;
+  if (dst == cdir) invlpg(dst_addr);
+  return 0;
+}
+
+/*
+  Procedure..: clone_dir
+  Description..: Creates a page directory for a new address
+    space. Kernel entries point at the same page tables as src;
+    private pages are shared copy-on-write. The directory comes
+    from the identity mapped buddy pool so its virtual address
+    can be loaded into cr3.
+*/
+page_dir* clone_dir(page_dir *src)
+{
+  page_dir *dir;
+  u32int i, j;
+
+  if (!buddy_ready) return 0;
+  if ((dir = (page_dir*)alloc_pages(pages_to_order(sizeof(page_dir)/PAGE_SIZE))) == 0)
+    return 0;
+  memset(dir, 0, sizeof(page_dir));
+
+  for (i=0; i<1024; i++){
+    if (!private_index(i)){
+      dir->tables[i] = src->tables[i];
+      dir->tables_phys[i] = src->tables_phys[i];
+    }
+    else if (src->tables[i]){
+      for (j=0; j<1024; j++)
+        if (src->tables[i]->pages[j].present)
+          map_cow(dir, (i*1024 + j)*PAGE_SIZE, src, (i*1024 + j)*PAGE_SIZE);
+    }
+  }
+  return dir;
+}
+
+/*
+  Procedure..: free_dir
+  Description..: Releases a directory made by clone_dir, its
+    private page tables and its share of their frames. Kernel
+    tables are left alone.
+*/
+void free_dir(page_dir *dir)
+{
+  u32int i, j;
+
+  if (dir == 0 || dir == kdir) return;
+  if (dir == cdir) switch_page_dir(kdir);
+  remove_regions(dir);
+
+  for (i=PROC_SPACE_BASE/LARGE_PAGE_SIZE; i<PROC_SPACE_END/LARGE_PAGE_SIZE; i++){
+    if (!dir->tables[i]) continue;
+    for (j=0; j<1024; j++)
+      if (dir->tables[i]->pages[j].present)
+        free_frame(&dir->tables[i]->pages[j]);
+    if (free_pages((u32int)dir->tables[i]))
+      kfree((u32int)dir->tables[i]);
+  }
+  free_pages((u32int)dir);
+}
+
+/*
+  Procedure..: cow_fault
+  Description..: Gives the current directory its own copy of a
+    copy-on-write page. The last sharer keeps the frame and just
+    gets write access back. The new frame is reached through
+    the scratch page while copying.
+*/
+int cow_fault(u32int addr)
+{
+  page_entry *page = get_page(addr, cdir, 0);
+  page_entry *scratch;
+  u32int index;
+
+  if (!page || !page->present || !page->cow) return 0;
+
+  if (frame_refs[page->frameaddr] > 0){
+    if ( (u32int)(-1) == (index=find_free()) ) kpanic("Out of memory");
+    set_bit(index*page_size);
+
+    scratch = get_page(SCRATCH_PAGE, kdir, 0);
+    scratch->present   = 1;
+    scratch->writeable = 1;
+    scratch->frameaddr = index;
+    invlpg(SCRATCH_PAGE);
+    memcpy((void*)SCRATCH_PAGE, (void*)(addr & 0xFFFFF000), PAGE_SIZE);
+    scratch->present   = 0;
+    scratch->frameaddr = 0;
+    invlpg(SCRATCH_PAGE);
+
+    frame_refs[page->frameaddr]--;
+    page->frameaddr = index;
+  }
+  page->cow = 0;
+  page->writeable = 1;
+  invlpg(addr);
+  return 1;
+}
+
+/*
+  Procedure..: add_region
+  Description..: Reserves a range as a demand-zero region.
+*/
+int add_region(page_dir *dir, u32int start, u32int end, u32int flags)
+{
+  region *r;
+
+  if (nregions >= MAX_REGIONS || start >= end
+      || (start & (PAGE_SIZE-1)) || (end & (PAGE_SIZE-1)))
+    return -1;
+
+  r = &regions[nregions++];
+  r->start = start;
+  r->end   = end;
+  r->flags = flags;
+  r->dir   = dir;
+  return 0;
+}
+
+/*
+  Procedure..: remove_regions
+  Description..: Drops every region owned by a directory. The
+    table is kept packed so lookups stop at nregions.
+*/
+void remove_regions(page_dir *dir)
+{
+  int i = 0;
+  while (i < nregions){
+    if (regions[i].dir == dir)
+      regions[i] = regions[--nregions];
+    else
+      i++;
+  }
+}
+
+/*
+  Procedure..: find_region
+  Description..: Finds the region of the current directory that
+    holds addr.
+*/
+region* find_region(u32int addr)
+{
+  int i;
+  for (i=0; i<nregions; i++)
+    if (addr >= regions[i].start && addr < regions[i].end
+        && (regions[i].dir == 0 || regions[i].dir == cdir))
+      return &regions[i];
+  return 0;
+}
+
+/*
+  Procedure..: zero_fault
+  Description..: Backs a not present page of a region with a
+    zeroed frame. Frames are reused without being cleared, so the
+    page is mapped writeable for the clear and only then given
+    the region's protection.
+*/
+int zero_fault(u32int addr, u32int write)
+{
+  region *r = find_region(addr);
+  page_entry *page;
+  u32int base = addr & 0xFFFFF000;
+
+  if (!r) return 0;
+  if (write && !(r->flags & REGION_WRITEABLE)) return 0;
+  if ((page = get_page(addr, cdir, 1)) == 0 || page->present) return 0;
+
+  new_frame(page);
+  invlpg(base);
+  memset((void*)base, 0, PAGE_SIZE);
+
+  page->writeable = (r->flags & REGION_WRITEABLE) ? 1 : 0;
+  page->usermode  = (r->flags & REGION_USERMODE) ? 1 : 0;
+  invlpg(base);
+  return 1;
+}
@@ -1,12 +1,72 @@
 #include <modules/mpx_supt.h>
+#include <term/pcb/pcb.h>
 #include <stdarg.h>
 
+extern pcb_t *cop; // running process, defined in system.c
+
+/// Output written before any process has been dispatched
+static char kernel_out_buf[PCB_OUT_SIZE + 1];
+static int kernel_out_len = 0;
+
+/*
+ * Procedure: out_buffer()
+ * Description: Finds the output buffer of the running process and
+ *  its length.
+ */
+static char *out_buffer(int **len) {
+	if(cop != NULL) {
+		*len = &cop->pcb_out_len;
+		return cop->pcb_out_buf;
+	}
+	*len = &kernel_out_len;
+	return kernel_out_buf;
+}
+
+/*
+ * Procedure: flush()
+ * Description: Writes out everything the running process has buffered
+ *  with a single device request.
+ */
+int flush() {
+	int *len;
+	char *buf = out_buffer(&len);
+	int count = *len;
+
+	if(count == 0)
+		return 0;
+	buf[count] = '\0';
+	*len = 0;
+	return sys_req(WRITE, DEFAULT_DEVICE, buf, &count);
+}
+
+/*
+ * Procedure: out_write()
+ * Description: Appends *str to the output buffer, flushing after each
+ *  newline and whenever the buffer fills up.
+ */
+static int out_write(char *str) {
+	int *len, ret = 0, r;
+	char *buf = out_buffer(&len);
+
+	for(; *str != '\0'; str++) {
+		buf[(*len)++] = *str;
+		if((*str == '\n' || *len == PCB_OUT_SIZE) && (r = flush()) != 0)
+			ret = r;
+	}
+	// line editing while reading has to show up right away
+	if(cop != NULL && cop->pcb_out_direct && (r = flush()) != 0)
+		ret = r;
+	return ret;
+}
+
 /*
  * Procedure: print()
- * Description: Write *str to serial output
+ * Description: Write *str to serial output. Like the polled driver has
+ *  always done, this stops at the NUL rather than trusting len.
 */
 int print(char *str, int len) {
-	return sys_req(WRITE, DEFAULT_DEVICE, str, &len);
+	(void)len;
+	return out_write(str);
 }
 
 /*
@@ -17,8 +77,7 @@ int printc(char c) {
 	char str[2];
 	str[0] = c;
 	str[1] = '\0';
-	int one = 1;
-	return sys_req(WRITE, DEFAULT_DEVICE, str, &one);	
+	return out_write(str);
 }
 
 /*
@@ -27,63 +86,65 @@ int printc(char c) {
  *  to the end.
 */
 int println(char *str, int len) {
-	int ret = sys_req(WRITE, DEFAULT_DEVICE, str, &len);
-	int one = 1;
-	sys_req(WRITE, DEFAULT_DEVICE, "\n", &one);
+	int ret = print(str, len);
+	out_write("\n");
 	return ret;
 }
 
-/* Basic implementation of printf.
- * Will probably mess up if you don't give it the right number of arguments, so don't do that.
+/*
+ * Procedure: printf()
+ * Description: Formats straight into the output buffer in one pass
+ *  (see vsnprintf for the conversions), so a whole line goes out
+ *  with a single write. Output that does not fit in the buffer is
+ *  formatted into a heap block and written at once.
  */
 void printf(char *str, ...) {
-	va_list args;
+	va_list args, again;
+	int *len, n, count, i;
+	char *buf = out_buffer(&len), *big;
+
 	va_start(args, str);
-	
-	int len = strlen(str);
-	char buf[len + 1];
-
-	int i, j;
-	for(i = 0, j = 0; str[i] != '\0'; i++) {
-		if(str[i] != '%') {
-			buf[j] = str[i];
-			j++;
+	va_copy(again, args);
+
+	n = vsnprintf(buf + *len, PCB_OUT_SIZE + 1 - *len, str, args);
+	if(*len + n > PCB_OUT_SIZE) {
+		// bytes past *len are scratch, so the partial result is simply dropped
+		flush();
+		if(n <= PCB_OUT_SIZE) {
+			vsnprintf(buf, PCB_OUT_SIZE + 1, str, again);
 		} else {
-			buf[j] = '\0';
-			print(buf, j);
-			j = 0;
-			
-			i++;
-			
-			switch(str[i]) {
-				case 'i':
-					print(itoa(va_arg(args, int)), 1);
-					break;
-				case 's':
-					print(va_arg(args, char *), 1);
-					break;
-				case 'c':
-					printc(va_arg(args, int));
-					break;
-				case '%':
-					printc('%');
-					break;
-				default:
-					printf("Illegal format string %%%c\n", str[i]);
-					return;
+			count = n;
+			big = (char *) sys_alloc_mem(n + 1);
+			if(big != NULL) {
+				vsnprintf(big, n + 1, str, again);
+				sys_req(WRITE, DEFAULT_DEVICE, big, &count);
+				sys_free_mem(big);
 			}
+			n = 0;
 		}
 	}
-	buf[j] = '\0';
-	print(buf, j);
 
+	for(i = *len; i < *len + n && buf[i] != '\n'; i++);
+	*len += n;
+	if(i < *len || (cop != NULL && cop->pcb_out_direct))
+		flush();
+
+	va_end(again);
 	va_end(args);
 }
 
 /*
  * Procedure: read()
- * Description: Reads *buf into serial input.
+ * Description: Reads *buf into serial input. Pending output such as
+ *  the prompt is written first.
 */
 int read(char *buf, int len) {
-	return sys_req(READ, DEFAULT_DEVICE, buf, &len);
+	flush();
+
+	if(cop != NULL)
+		cop->pcb_out_direct = 1;
+	int ret = sys_req(READ, DEFAULT_DEVICE, buf, &len);
+	if(cop != NULL)
+		cop->pcb_out_direct = 0;
+	return ret;
 }
@@ -114,6 +114,13 @@ void showreadypcbHelp();
 */
 void showblockedpcbHelp();
 
+/**
+ * Help page for showstackpcb
+ * 
+ * Displays the showstackpcb help page
+*/
+void showstackpcbHelp();
+
 /**
  * Help page for block
  * 
@@ -220,11 +227,55 @@ void clearHelp();
 */
 void aliasHelp();
 
+/**
+ * Help page for heapcheck
+ * 
+ * Displays the heapcheck help pages
+*/
+void heapcheckHelp();
+
+/**
+ * Help page for memprof
+ * 
+ * Displays the memprof help pages
+*/
+void memprofHelp();
+
+/**
+ * Help page for setbaud
+ * 
+ * Displays the setbaud help pages
+*/
+void setbaudHelp();
+
+/**
+ * Help page for dmesg
+ * 
+ * Displays the dmesg help pages
+*/
+void dmesgHelp();
+
+/**
+ * Help page for trace
+ * 
+ * Displays the trace help pages
+*/
+void traceHelp();
+
 
+/*
+ * Output is gathered in a buffer of the running process and written
+ * with one device request when a newline is printed, when the buffer
+ * fills up or when flush() is called. read() flushes first, so a
+ * prompt always shows before the process waits for input, and
+ * sys_req flushes before IDLE and EXIT, so a process never leaves
+ * the cpu with a partial line held back.
+ */
 int print(char *, int);
 int printc(char);
 int println(char *, int);
 void printf(char *, ...);
+int flush();
 int read(char *, int);
 
 #endif
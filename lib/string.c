@@ -75,39 +75,14 @@ int atoi(const char *s)
 /*
  * Procedure: itoa()
  * Description: Converts 32-bit integer to an array of bytes
- *   representing the integer.
+ *   representing the integer. The digits live in a static buffer
+ *   that is reused by the next call.
 */
 char * itoa(int value) {
-  
-  int sizeValue = value;
-  int length = 1;
+  static char number[12];
 
-  /* Determine the length of the decimal */
-  while (sizeValue /= 10) {
-    length++;
-  }
-  
-  char digit;
-  char *start; /* Points to the start of the array */
-  
-  /* The array where each ascii value will be stored */
-  char number[64];
-  memset(number,'\0',64);
-
-  /*
-   * This loop iterates backwards in order to write the bytes
-   * in the correct order. 
-  */
-  int i;
-  for ( i = length - 1; i > -1; i--) {
-    int rem = value % 10;
-    value = value / 10;
-    digit = rem + '0';
-    number[i] = digit;
-  }
-
-  start = number;
-  return start;
+  snprintf(number, sizeof(number), "%d", value);
+  return number;
 }
 
 /*
@@ -182,6 +157,21 @@ void* memset(void *s, int c, size_t n)
   return s;
 }
 
+/*
+  Procedure..: memcpy
+  Description..: Copy a region of memory. The regions must not overlap.
+  Params..: s1-destination, s2-source, n-count
+*/
+void* memcpy(void *s1, const void *s2, size_t n)
+{
+  unsigned char *d = (unsigned char *) s1;
+  const unsigned char *s = (const unsigned char *) s2;
+  while(n--){
+    *d++ = *s++;
+  }
+  return s1;
+}
+
 /*
   Procedure..: strtok
   Description..: Split string into tokens
@@ -239,17 +229,227 @@ char* strtok(char *s1, const char *s2)
 
 
 
-/* And finally....
-   For the brave ones! (Note: you'll need to add a prototype to string.h)
-   sprintf must work properly for the following types to receive extra credit:
-     1) characters
-     2) strings
-     3) signed integers
-     4) hexadecimal numbers may be useful
-     ...
-     \infty) Or feel free to completely implement sprintf
-             (Read the man Page: $ man sprintf)
-   int sprintf(char *str, const char *format, ...); 
+/*
+  Procedure..: fmt_out
+  Description..: Stores one character of vsnprintf output if it
+      still fits, but always counts it.
+*/
+struct fmt_dest {
+  char *buf;
+  size_t size;
+  size_t len;
+};
+
+static void fmt_out(struct fmt_dest *d, char c)
+{
+  if (d->len + 1 < d->size)
+    d->buf[d->len] = c;
+  d->len++;
+}
+
+static void fmt_pad(struct fmt_dest *d, char c, int n)
+{
+  while (n-- > 0)
+    fmt_out(d, c);
+}
+
+/*
+  Procedure..: fmt_num
+  Description..: Writes an unsigned number in the given base,
+      honouring the sign, width, precision and flags of the
+      conversion it came from.
+*/
+#define FMT_LEFT  0x01 //'-' flag
+#define FMT_ZERO  0x02 //'0' flag
+#define FMT_PLUS  0x04 //'+' flag
+#define FMT_SPACE 0x08 //' ' flag
+#define FMT_UPPER 0x10 //%X
+
+static void fmt_num(struct fmt_dest *d, u32int value, int neg, u32int base,
+		    int flags, int width, int prec)
+{
+  const char *digits = (flags & FMT_UPPER) ? "0123456789ABCDEF" : "0123456789abcdef";
+  char tmp[12];
+  int n = 0, zeros, sign;
+
+  //a precision of 0 prints nothing for a zero value
+  while (value != 0 || (n == 0 && prec != 0)){
+    tmp[n++] = digits[value % base];
+    value /= base;
+  }
+
+  sign = neg ? '-' : (flags & FMT_PLUS) ? '+' : (flags & FMT_SPACE) ? ' ' : 0;
+  zeros = prec > n ? prec - n : 0;
+  width -= n + zeros + (sign != 0);
+
+  //'0' is ignored with '-' or an explicit precision
+  if ((flags & FMT_ZERO) && !(flags & FMT_LEFT) && prec < 0){
+    zeros += width;
+    width = 0;
+  }
+
+  if (!(flags & FMT_LEFT))
+    fmt_pad(d, ' ', width);
+  if (sign)
+    fmt_out(d, sign);
+  fmt_pad(d, '0', zeros);
+  while (n > 0)
+    fmt_out(d, tmp[--n]);
+  if (flags & FMT_LEFT)
+    fmt_pad(d, ' ', width);
+}
+
+/*
+  Procedure..: vsnprintf
+  Description..: Formats in a single pass over fmt. Supports the
+      -, 0, + and space flags, field width and precision (either of
+      which may be *), the l modifier and the d, i, u, x, X, p, c, s
+      and % conversions. Unknown conversions are copied as is.
+*/
+int vsnprintf(char *str, size_t size, const char *fmt, va_list ap)
+{
+  struct fmt_dest d;
+  int flags, width, prec, n, i;
+  const char *s;
+
+  d.buf = str;
+  d.size = size;
+  d.len = 0;
+
+  for (; *fmt; fmt++){
+    if (*fmt != '%'){
+      fmt_out(&d, *fmt);
+      continue;
+    }
+
+    //flags
+    flags = 0;
+    for (;;){
+      fmt++;
+      if (*fmt == '-') flags |= FMT_LEFT;
+      else if (*fmt == '0') flags |= FMT_ZERO;
+      else if (*fmt == '+') flags |= FMT_PLUS;
+      else if (*fmt == ' ') flags |= FMT_SPACE;
+      else break;
+    }
+
+    //field width
+    width = 0;
+    if (*fmt == '*'){
+      width = va_arg(ap, int);
+      if (width < 0){
+	flags |= FMT_LEFT;
+	width = -width;
+      }
+      fmt++;
+    }
+    else
+      while (*fmt >= '0' && *fmt <= '9')
+	width = width * 10 + (*fmt++ - '0');
+
+    //precision; -1 when none was given
+    prec = -1;
+    if (*fmt == '.'){
+      fmt++;
+      prec = 0;
+      if (*fmt == '*'){
+	prec = va_arg(ap, int);
+	fmt++;
+      }
+      else
+	while (*fmt >= '0' && *fmt <= '9')
+	  prec = prec * 10 + (*fmt++ - '0');
+    }
+
+    //long is the same size as int here
+    while (*fmt == 'l')
+      fmt++;
+
+    switch (*fmt){
+    case 'd':
+    case 'i':
+      n = va_arg(ap, int);
+      fmt_num(&d, n < 0 ? -(u32int)n : (u32int)n, n < 0, 10, flags, width, prec);
+      break;
+    case 'u':
+      fmt_num(&d, va_arg(ap, u32int), 0, 10, flags, width, prec);
+      break;
+    case 'X':
+      flags |= FMT_UPPER;
+      /* fall through */
+    case 'x':
+      fmt_num(&d, va_arg(ap, u32int), 0, 16, flags & ~(FMT_PLUS | FMT_SPACE), width, prec);
+      break;
+    case 'p':
+      fmt_out(&d, '0');
+      fmt_out(&d, 'x');
+      fmt_num(&d, (u32int)va_arg(ap, void*), 0, 16, FMT_ZERO, 8, -1);
+      break;
+    case 'c':
+      if (!(flags & FMT_LEFT))
+	fmt_pad(&d, ' ', width - 1);
+      fmt_out(&d, (char)va_arg(ap, int));
+      if (flags & FMT_LEFT)
+	fmt_pad(&d, ' ', width - 1);
+      break;
+    case 's':
+      s = va_arg(ap, const char*);
+      if (s == NULL)
+	s = "(null)";
+      for (n = 0; s[n] && (prec < 0 || n < prec); n++);
+      if (!(flags & FMT_LEFT))
+	fmt_pad(&d, ' ', width - n);
+      for (i = 0; i < n; i++)
+	fmt_out(&d, s[i]);
+      if (flags & FMT_LEFT)
+	fmt_pad(&d, ' ', width - n);
+      break;
+    case '%':
+      fmt_out(&d, '%');
+      break;
+    case '\0':
+      //a lone % at the end of the string
+      fmt--;
+      break;
+    default:
+      fmt_out(&d, '%');
+      fmt_out(&d, *fmt);
+      break;
+    }
+  }
+
+  if (size > 0)
+    str[d.len < size ? d.len : size - 1] = '\0';
+  return d.len;
+}
+
+/*
+  Procedure..: snprintf
+  Description..: vsnprintf with its arguments passed directly.
 */
+int snprintf(char *str, size_t size, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
 
+  va_start(ap, fmt);
+  n = vsnprintf(str, size, fmt, ap);
+  va_end(ap);
+  return n;
+}
 
+/*
+  Procedure..: sprintf
+  Description..: snprintf without a bound. Only for callers that know
+      their buffer is large enough.
+*/
+int sprintf(char *str, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(str, (size_t)-1 / 2, fmt, ap);
+  va_end(ap);
+  return n;
+}
@@ -7,14 +7,24 @@
 **************************************************************/
 #include "mpx_supt.h"
 #include <mem/heap.h>
+#include <mem/paging.h>
+#include <mem/buddy.h>
 #include <string.h>
 #include <core/serial.h>
 #include "../lib/out.h"
+#include "../term/pcb/pcb.h"
+#include "../serial_driver/driver.h"
+#include <core/iosched.h>
+#include <core/trace.h>
 
 // global variable containing parameter used when making 
 // system calls via sys_req
 param params;   
 
+// currently operating process; allocations are charged to it.
+// defined in system.c
+extern pcb_t *cop;
+
 // global for the current module
 int current_module = -1;  
 static int io_module_active = 0;
@@ -28,8 +38,72 @@ u32int (*student_malloc)(u32int);
 // is a pointer to the student's "free" operation.
 int (*student_free)(void *);
 
+// optional in place resize and zeroed allocation of the
+// student heap manager; NULL when it has none
+u32int (*student_resize)(void *, u32int);
+u32int (*student_calloc)(u32int);
+u32int (*student_aligned)(u32int, u32int);
+
+// background work run by the idle process; NULL for none.
+// returns nonzero while there is more to do
+int (*idle_work)(void);
+
+// kernel heap; defined in heap.c
+extern heap* kheap;
+
+// a process's arena sits at the bottom of the private part of its
+// address space, where no other process can reach it
+#define ARENA_BASE PROC_SPACE_BASE
+
+// Allocation profiler. Every live block is kept in an open
+// addressed table keyed by its address, so frees can find the
+// tag and call site they are charged to.
+#define TRACK_SIZE 1024 // must be a power of two
+#define MAX_SITES  64
+
+typedef struct {
+  u32int addr;  // 0 marks an empty slot
+  u32int size;
+  int tag;
+  int site;     // index into site_stats, -1 if that table was full
+  pcb_t *owner; // process charged for the block, NULL for the kernel
+} mem_track;
+
+static mem_track tracked[TRACK_SIZE];
+static int ntracked = 0;
+static mem_tag_stats tag_stats[MEM_TAG_COUNT];
+static mem_site_stats site_stats[MAX_SITES];
+static int nsites = 0;
+
+static char *tag_names[MEM_TAG_COUNT] = {
+  "other", "pcb", "args", "history", "alias", "alarms"
+};
 
 
+
+/*
+  Procedure..: io_request
+  Description..: Passes a READ or WRITE to sys_call, which queues
+			it on the device and blocks the process until the
+			driver is done. Without a process to block, or when
+			no IOCB is free, waits for the driver right here.
+  Params..: op_code - READ or WRITE
+			device_id, buffer_ptr, count_ptr - as passed to sys_req
+*/
+static int io_request(int op_code, int device_id, char *buffer_ptr, int *count_ptr)
+{
+  if (cop != NULL) {
+    params.op_code = op_code;
+    params.device_id = device_id;
+    params.buffer_ptr = buffer_ptr;
+    params.count_ptr = count_ptr;
+    asm volatile ("int $60");
+    if (cop->pcb_io_status != IO_NO_IOCB)
+      return cop->pcb_io_status;
+  }
+  return io_sync(op_code, device_id, buffer_ptr, count_ptr);
+}
+
 /* *********************************************
 *	This function is use to issue system requests
 *	for service.  
@@ -38,8 +112,8 @@ int (*student_free)(void *);
 *					READ, WRITE, IDLE, EXIT
 *			  device_id:  For READ & WRITE this is the
 *					  device to which the request is 
-*					  sent.  One of DEFAULT_DEVICE or
-*					   COM_PORT
+*					  sent.  One of DEFAULT_DEVICE,
+*					   COM_PORT, COM3_PORT or COM4_PORT
 *			   buffer_ptr:  pointer to a character buffer
 *					to be used with READ & WRITE request
 *			   count_ptr:  pointer to an integer variable
@@ -56,6 +130,10 @@ int sys_req( 	int  op_code,
 	int return_code =0;
 
   if (op_code == IDLE || op_code == EXIT){
+    // a partial line would be lost on EXIT, and would show up out
+    // of order behind the next process's output on IDLE
+    flush();
+
     // store the process's operation request
     // triger interrupt 60h to invoke
     params.op_code = op_code;
@@ -85,7 +163,18 @@ int sys_req( 	int  op_code,
           return_code = serial_print(buffer_ptr);	
 	    
       } else {// I/O module is implemented
-        asm volatile ("int $60");
+        if (op_code == READ && device_id == DEFAULT_DEVICE)
+          // the terminal keeps its line editing; keys come from the driver
+          return_code = *(polling(buffer_ptr, count_ptr));
+        else if (op_code == WRITE && device_id == DEFAULT_DEVICE) {
+          // like serial_print, terminal writes stop at the NUL
+          // whatever the count says
+          int len = strlen(buffer_ptr);
+          if (len > 0)
+            return_code = io_request(op_code, device_id, buffer_ptr, &len);
+        }
+        else
+          return_code = io_request(op_code, device_id, buffer_ptr, count_ptr);
       } // NOT IO_MODULE
     }
   } else return_code = INVALID_OPERATION;
@@ -111,7 +200,8 @@ void mpx_init(int cur_mod)
   if (cur_mod == MEM_MODULE)
 		mem_module_active = TRUE;
 
-  if (cur_mod == IO_MODULE)
+  // sys_req only hands I/O to the driver once COM1 is open
+  if (cur_mod == IO_MODULE && io_init() == 0)
 		io_module_active = TRUE;
 }
 
@@ -138,6 +228,308 @@ void sys_set_free(int (*func)(void *))
   student_free = func;
 }
 
+/*
+  Procedure..: track_slot
+  Description..: First slot of addr's probe sequence
+*/
+static int track_slot(u32int addr)
+{
+  return (int)(((addr >> 4) * 2654435761u) & (TRACK_SIZE - 1));
+}
+
+/*
+  Procedure..: hist_bucket
+  Description..: Size histogram bucket of an allocation
+*/
+static int hist_bucket(u32int size)
+{
+  int b = 0;
+  while (b < MEM_HIST_BUCKETS - 1 && size > (u32int)(16 << b))
+    b++;
+  return b;
+}
+
+/*
+  Procedure..: find_site
+  Description..: Index of a call site's counters, added on
+			first use. -1 when the site table is full.
+*/
+static int find_site(u32int site, int tag)
+{
+  int i;
+  for (i = 0; i < nsites; i++)
+    if (site_stats[i].site == site && site_stats[i].tag == tag)
+      return i;
+  if (nsites >= MAX_SITES)
+    return -1;
+  memset(&site_stats[nsites], 0, sizeof(mem_site_stats));
+  site_stats[nsites].site = site;
+  site_stats[nsites].tag = tag;
+  return nsites++;
+}
+
+/*
+  Procedure..: mem_owner
+  Description..: Process a block is charged to. PCBs, stacks and
+			queue nodes belong to the scheduler rather than to
+			whoever is running when sys_call makes them, so they
+			have no owner and no quota
+*/
+static pcb_t *mem_owner(int tag)
+{
+  return tag == MEM_TAG_PCB ? NULL : cop;
+}
+
+/*
+  Procedure..: track_alloc
+  Description..: Charges a new block to its tag, call site and owner
+*/
+static void track_alloc(u32int addr, u32int size, int tag, u32int site)
+{
+  mem_tag_stats *t = &tag_stats[tag];
+  pcb_t *owner = mem_owner(tag);
+  int i, s;
+
+  t->allocs++;
+  t->hist[hist_bucket(size)]++;
+  if (!addr) {
+    t->failed++;
+    return;
+  }
+  TRACE(TRACE_ALLOC, 0, tag, size);
+  // keep one slot empty so probes always stop. deny_alloc refuses
+  // owned blocks before that, so only ownerless ones go untracked
+  if (ntracked >= TRACK_SIZE - 1) {
+    t->untracked++;
+    return;
+  }
+
+  t->live_bytes += size;
+  t->live_blocks++;
+  if (t->live_bytes > t->peak_bytes)
+    t->peak_bytes = t->live_bytes;
+
+  s = find_site(site, tag);
+  if (s >= 0) {
+    site_stats[s].live_bytes += size;
+    site_stats[s].live_blocks++;
+    site_stats[s].allocs++;
+  }
+
+  for (i = track_slot(addr); tracked[i].addr; i = (i + 1) & (TRACK_SIZE - 1));
+  tracked[i].addr = addr;
+  tracked[i].size = size;
+  tracked[i].tag = tag;
+  tracked[i].site = s;
+  tracked[i].owner = owner;
+  ntracked++;
+
+  if (owner != NULL) {
+    owner->pcb_mem_used += size;
+    if (owner->pcb_mem_used > owner->pcb_mem_peak)
+      owner->pcb_mem_peak = owner->pcb_mem_used;
+  }
+}
+
+/*
+  Procedure..: deny_alloc
+  Description..: Checks if a block charged to the current process
+			must be refused: size more bytes would take it past its
+			limit, or the table is too full to record the owner,
+			which would hide the block from quotas and
+			sys_free_owner. Counts the refusal if so
+*/
+static int deny_alloc(u32int size, int tag)
+{
+  pcb_t *owner = mem_owner(tag);
+
+  if (owner == NULL)
+    return 0;
+  if (ntracked < TRACK_SIZE - 1 && (owner->pcb_mem_limit == 0
+      || owner->pcb_mem_used + size <= owner->pcb_mem_limit))
+    return 0;
+  owner->pcb_mem_denied++;
+  return 1;
+}
+
+/*
+  Procedure..: track_lookup
+  Description..: Slot of a live block, -1 if it is not tracked
+*/
+static int track_lookup(u32int addr)
+{
+  int i;
+  for (i = track_slot(addr); tracked[i].addr; i = (i + 1) & (TRACK_SIZE - 1))
+    if (tracked[i].addr == addr)
+      return i;
+  return -1;
+}
+
+/*
+  Procedure..: track_free
+  Description..: Uncharges a freed block. Later entries of the
+			probe run are shifted back so no tombstones are left.
+*/
+static void track_free(u32int addr)
+{
+  int i = track_lookup(addr), j, k;
+  mem_track *e;
+
+  if (i < 0)
+    return;
+  e = &tracked[i];
+  TRACE(TRACE_FREE, 0, e->tag, e->size);
+  tag_stats[e->tag].live_bytes -= e->size;
+  tag_stats[e->tag].live_blocks--;
+  tag_stats[e->tag].frees++;
+  if (e->site >= 0) {
+    site_stats[e->site].live_bytes -= e->size;
+    site_stats[e->site].live_blocks--;
+  }
+  if (e->owner != NULL)
+    e->owner->pcb_mem_used -= e->size;
+
+  tracked[i].addr = 0;
+  ntracked--;
+  for (j = (i + 1) & (TRACK_SIZE - 1); tracked[j].addr; j = (j + 1) & (TRACK_SIZE - 1)) {
+    k = track_slot(tracked[j].addr);
+    // move j into the hole unless its home slot lies in (i, j]
+    if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+      tracked[i] = tracked[j];
+      tracked[j].addr = 0;
+      i = j;
+    }
+  }
+}
+
+/*
+  Procedure..: track_resize
+  Description..: Moves the charge of a block resized in place
+*/
+static void track_resize(u32int addr, u32int size)
+{
+  int i = track_lookup(addr);
+  mem_track *e;
+
+  if (i < 0)
+    return;
+  e = &tracked[i];
+  tag_stats[e->tag].live_bytes += size - e->size;
+  if (tag_stats[e->tag].live_bytes > tag_stats[e->tag].peak_bytes)
+    tag_stats[e->tag].peak_bytes = tag_stats[e->tag].live_bytes;
+  if (e->site >= 0)
+    site_stats[e->site].live_bytes += size - e->size;
+  if (e->owner != NULL) {
+    e->owner->pcb_mem_used += size - e->size;
+    if (e->owner->pcb_mem_used > e->owner->pcb_mem_peak)
+      e->owner->pcb_mem_peak = e->owner->pcb_mem_used;
+  }
+  e->size = size;
+}
+
+/*
+  Procedure..: arena_alloc
+  Description..: Bumps an allocation out of the current process's
+			arena if it serves the tag. Each object is preceded by
+			its size so realloc can copy it. NULL if there is no
+			arena for the tag or it is full.
+*/
+static void *arena_alloc(u32int size, u32int align, int tag)
+{
+  u32int p;
+
+  if (cop == NULL || cop->pcb_arena_base == NULL || tag != cop->pcb_arena_tag)
+    return NULL;
+  if (align < sizeof(u32int))
+    align = sizeof(u32int);
+
+  p = ((u32int) cop->pcb_arena_next + sizeof(u32int) + align - 1) & ~(align - 1);
+  if (p + size > (u32int) cop->pcb_arena_end || p + size < p)
+    return NULL;
+
+  ((u32int *) p)[-1] = size;
+  cop->pcb_arena_next = (unsigned char *) (p + size);
+  return (void *) p;
+}
+
+/*
+  Procedure..: arena_owns
+  Description..: Checks if a block lies in the current process's arena
+*/
+static int arena_owns(void *ptr)
+{
+  return cop != NULL && cop->pcb_arena_base != NULL
+    && (unsigned char *) ptr > cop->pcb_arena_base
+    && (unsigned char *) ptr < cop->pcb_arena_end;
+}
+
+/*
+  Procedure..: alloc_mem
+  Description..: Picks the allocator for a request
+*/
+static void *alloc_mem(u32int size)
+{
+  u32int addr;
+
+  // Page-sized and larger requests come from the buddy pool so
+  // they don't fragment the small-object heap
+  if (size >= PAGE_SIZE){
+    addr = alloc_pages(pages_to_order((size + PAGE_SIZE - 1) / PAGE_SIZE));
+    if (addr)
+      return (void *) addr;
+  }
+
+  if (!mem_module_active)
+    addr = kmalloc(size);
+  else
+    addr = (*student_malloc)(size);
+
+  // the MCB heap reports failure as -1
+  if (addr == (u32int) -1)
+    addr = 0;
+  return (void *) addr;
+}
+
+/*
+  Procedure..: sys_set_resize
+  Description..: Sets the in place resize function for sys_realloc_mem
+  Params..: Function pointer
+*/
+void sys_set_resize(u32int (*func)(void *, u32int))
+{
+  student_resize = func;
+}
+
+/*
+  Procedure..: sys_set_calloc
+  Description..: Sets the zeroed allocation function for sys_calloc_mem
+  Params..: Function pointer
+*/
+void sys_set_calloc(u32int (*func)(u32int))
+{
+  student_calloc = func;
+}
+
+/*
+  Procedure..: sys_set_aligned
+  Description..: Sets the aligned allocation function for sys_alloc_mem_aligned
+  Params..: Function pointer
+*/
+void sys_set_aligned(u32int (*func)(u32int, u32int))
+{
+  student_aligned = func;
+}
+
+/*
+  Procedure..: sys_set_idle
+  Description..: Sets background work for the idle process
+  Params..: Function pointer
+*/
+void sys_set_idle(int (*func)(void))
+{
+  idle_work = func;
+}
+
 /*
   Procedure..: sys_alloc_mem
   Description..: Allocates a block of memory (similar to malloc)
@@ -145,10 +537,323 @@ void sys_set_free(int (*func)(void *))
 */
 void *sys_alloc_mem(u32int size)
 {
-  if (!mem_module_active)
-    return (void *) kmalloc(size);
+  void *ptr = arena_alloc(size, 0, MEM_TAG_OTHER);
+  if (ptr != NULL)
+    return ptr;
+
+  ptr = deny_alloc(size, MEM_TAG_OTHER) ? NULL : alloc_mem(size);
+  track_alloc((u32int) ptr, size, MEM_TAG_OTHER,
+	      (u32int) __builtin_return_address(0));
+  return ptr;
+}
+
+/*
+  Procedure..: sys_alloc_mem_tagged
+  Description..: Allocates a block of memory and charges it to
+			an owner tag and the calling site for memprof
+  Params..: Number of bytes to allocate, one of MEM_TAG_*
+*/
+void *sys_alloc_mem_tagged(u32int size, int tag)
+{
+  void *ptr;
+
+  if (tag < 0 || tag >= MEM_TAG_COUNT)
+    tag = MEM_TAG_OTHER;
+  if ((ptr = arena_alloc(size, 0, tag)) != NULL)
+    return ptr;
+  ptr = deny_alloc(size, tag) ? NULL : alloc_mem(size);
+  track_alloc((u32int) ptr, size, tag,
+	      (u32int) __builtin_return_address(0));
+  return ptr;
+}
+
+/*
+  Procedure..: sys_alloc_mem_aligned
+  Description..: Allocates a block of memory whose address is a
+			multiple of align
+  Params..: Number of bytes, alignment (a power of two), one of MEM_TAG_*
+*/
+void *sys_alloc_mem_aligned(u32int size, u32int align, int tag)
+{
+  u32int addr = 0, order;
+
+  // 0 would pass the power of two test and wrap every mask below
+  if (align == 0 || (align & (align - 1)))
+    return NULL;
+  if (tag < 0 || tag >= MEM_TAG_COUNT)
+    tag = MEM_TAG_OTHER;
+  if ((addr = (u32int) arena_alloc(size, align, tag)) != 0)
+    return (void *) addr;
+  if (deny_alloc(size, tag)) {
+    track_alloc(0, size, tag, (u32int) __builtin_return_address(0));
+    return NULL;
+  }
+
+  // Buddy blocks of order k sit on a (PAGE_SIZE << k) boundary,
+  // so page and larger alignments come from the pool
+  if (align >= PAGE_SIZE || size >= PAGE_SIZE) {
+    order = pages_to_order((size + PAGE_SIZE - 1) / PAGE_SIZE);
+    while (align > ((u32int) PAGE_SIZE << order))
+      order++;
+    addr = alloc_pages(order);
+  }
+
+  // Smaller alignments pad inside the heap; the padding stays free
+  if (!addr && align < PAGE_SIZE) {
+    if (!mem_module_active)
+      addr = alloc_aligned(size, kheap, align);
+    else if (student_aligned != NULL)
+      addr = (*student_aligned)(size, align);
+    if (addr == (u32int) -1)
+      addr = 0;
+  }
+
+  track_alloc(addr, size, tag, (u32int) __builtin_return_address(0));
+  return (void *) addr;
+}
+
+/*
+  Procedure..: sys_realloc_mem
+  Description..: Resizes a block of memory (similar to realloc)
+  Params..: Block to resize (NULL allocates), new size in bytes
+			(0 frees)
+*/
+void *sys_realloc_mem(void *ptr, u32int size)
+{
+  u32int addr = (u32int) ptr, cap;
+  int i, tag = MEM_TAG_OTHER;
+  void *moved;
+
+  if (ptr == NULL) {
+    if ((moved = arena_alloc(size, 0, tag)) != NULL)
+      return moved;
+    moved = deny_alloc(size, tag) ? NULL : alloc_mem(size);
+    track_alloc((u32int) moved, size, tag,
+		(u32int) __builtin_return_address(0));
+    return moved;
+  }
+  if (size == 0) {
+    sys_free_mem(ptr);
+    return NULL;
+  }
+
+  if (arena_owns(ptr)) {
+    cap = ((u32int *) ptr)[-1];
+    // the newest object can grow or shrink by moving the bump pointer
+    if ((unsigned char *) ptr + cap == cop->pcb_arena_next
+	&& addr + size <= (u32int) cop->pcb_arena_end) {
+      ((u32int *) ptr)[-1] = size;
+      cop->pcb_arena_next = (unsigned char *) ptr + size;
+      return ptr;
+    }
+    if (size <= cap)
+      return ptr;
+    if ((moved = arena_alloc(size, 0, cop->pcb_arena_tag)) == NULL) {
+      tag = cop->pcb_arena_tag;
+      moved = deny_alloc(size, tag) ? NULL : alloc_mem(size);
+      track_alloc((u32int) moved, size, tag,
+		  (u32int) __builtin_return_address(0));
+      if (moved == NULL)
+	return NULL;
+    }
+    memcpy(moved, ptr, cap);
+    return moved;
+  }
+
+  // current capacity, after an in place resize where possible
+  if (buddy_owns(addr))
+    cap = buddy_block_size(addr);
+  else if (mem_module_active && student_resize != NULL)
+    cap = (*student_resize)(ptr, size);
+  else if (mem_module_active)
+    cap = (i = track_lookup(addr)) < 0 ? 0 : tracked[i].size;
   else
-    return (void *) (*student_malloc)(size);
+    cap = ksize(addr);
+
+  if (cap == 0)
+    return NULL; // not a block we handed out
+
+  // only the growth counts against the limit
+  i = track_lookup(addr);
+  if (i >= 0)
+    tag = tracked[i].tag;
+  if (size > (i < 0 ? cap : tracked[i].size)
+      && deny_alloc(size - (i < 0 ? cap : tracked[i].size), tag))
+    return NULL;
+
+  if (cap >= size) {
+    track_resize(addr, size);
+    return ptr;
+  }
+
+  // move it, keeping the owner tag
+  moved = alloc_mem(size);
+  track_alloc((u32int) moved, size, tag,
+	      (u32int) __builtin_return_address(0));
+  if (moved == NULL)
+    return NULL;
+  memcpy(moved, ptr, cap);
+  sys_free_mem(ptr);
+  return moved;
+}
+
+/*
+  Procedure..: sys_calloc_mem
+  Description..: Allocates a zeroed array (similar to calloc)
+  Params..: Number of elements, size of one element
+*/
+void *sys_calloc_mem(u32int count, u32int size)
+{
+  u32int total = count * size, addr;
+
+  if (count != 0 && total / count != size)
+    return NULL; // overflow
+  if ((addr = (u32int) arena_alloc(total, 0, MEM_TAG_OTHER)) != 0) {
+    memset((void *) addr, 0, total);
+    return (void *) addr;
+  }
+  if (deny_alloc(total, MEM_TAG_OTHER)) {
+    track_alloc(0, total, MEM_TAG_OTHER, (u32int) __builtin_return_address(0));
+    return NULL;
+  }
+
+  // buddy blocks and the kernel heap don't know what they hold
+  if (mem_module_active && student_calloc != NULL && total < PAGE_SIZE) {
+    addr = (*student_calloc)(total);
+    if (addr == (u32int) -1)
+      addr = 0;
+  } else {
+    addr = (u32int) alloc_mem(total);
+    if (addr)
+      memset((void *) addr, 0, total);
+  }
+
+  track_alloc(addr, total, MEM_TAG_OTHER,
+	      (u32int) __builtin_return_address(0));
+  return (void *) addr;
+}
+
+/*
+  Procedure..: sys_arena_init
+  Description..: Turns on arena mode for one tag of the current process
+  Params..: Size of the arena in bytes, one of MEM_TAG_*
+*/
+int sys_arena_init(u32int size, int tag)
+{
+  page_dir *dir;
+
+  // PCB blocks outlive the process that allocates them
+  if (cop == NULL || cop->pcb_arena_base != NULL || size == 0
+      || tag < 0 || tag >= MEM_TAG_COUNT || mem_owner(tag) == NULL
+      || size > PROC_SPACE_END - ARENA_BASE)
+    return -1;
+
+  // the first private pages of a process get it a directory of its own
+  if (cop->pcb_page_dir == kdir) {
+    if ((dir = clone_dir(kdir)) == 0)
+      return -1;
+    cop->pcb_page_dir = dir;
+    switch_page_dir(dir);
+  }
+
+  // pages are backed with zeroes as the bump pointer reaches them.
+  // Pages a parent shared with us stay copy-on-write
+  size = (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+  if (add_region(cop->pcb_page_dir, ARENA_BASE, ARENA_BASE + size, REGION_WRITEABLE))
+    return -1;
+
+  cop->pcb_arena_base = (unsigned char *) ARENA_BASE;
+  cop->pcb_arena_next = (unsigned char *) ARENA_BASE;
+  cop->pcb_arena_end = (unsigned char *) ARENA_BASE + size;
+  cop->pcb_arena_tag = tag;
+  return 0;
+}
+
+/*
+  Procedure..: sys_arena_reset
+  Description..: Drops every allocation in the current process's arena
+*/
+void sys_arena_reset()
+{
+  if (cop != NULL)
+    cop->pcb_arena_next = cop->pcb_arena_base;
+}
+
+/*
+  Procedure..: sys_free_owner
+  Description..: Frees every block charged to a process in one
+			pass over the live block table
+  Params..: PCB of the process
+*/
+int sys_free_owner(void *owner)
+{
+  pcb_t *pcb = owner;
+  int i = 0, freed = 0;
+
+  if (owner == NULL)
+    return 0;
+
+  // the arena's pages go with the process's directory
+  pcb->pcb_arena_base = NULL;
+  pcb->pcb_arena_next = NULL;
+  pcb->pcb_arena_end = NULL;
+  while (i < TRACK_SIZE) {
+    // freeing shifts a later entry into slot i, so look at it again
+    if (tracked[i].addr && tracked[i].owner == owner
+	&& sys_free_mem((void *) tracked[i].addr) == 0)
+      freed++;
+    else
+      i++;
+  }
+  return freed;
+}
+
+/*
+  Procedure..: sys_mem_tag_name
+  Description..: Name of an owner tag
+  Params..: One of MEM_TAG_*
+*/
+char *sys_mem_tag_name(int tag)
+{
+  if (tag < 0 || tag >= MEM_TAG_COUNT)
+    return "unknown";
+  return tag_names[tag];
+}
+
+/*
+  Procedure..: sys_mem_tag_of
+  Description..: Owner tag of a live block, -1 if not tracked
+  Params..: Pointer returned by sys_alloc_mem(_tagged)
+*/
+int sys_mem_tag_of(void *ptr)
+{
+  int i = track_lookup((u32int) ptr);
+  return i < 0 ? -1 : tracked[i].tag;
+}
+
+/*
+  Procedure..: sys_mem_tag_stats
+  Description..: Allocation counters of an owner tag
+  Params..: One of MEM_TAG_*
+*/
+mem_tag_stats *sys_mem_tag_stats(int tag)
+{
+  if (tag < 0 || tag >= MEM_TAG_COUNT)
+    return NULL;
+  return &tag_stats[tag];
+}
+
+/*
+  Procedure..: sys_mem_site_stats
+  Description..: Allocation counters of the i-th call site,
+			NULL past the last recorded site
+  Params..: Site index
+*/
+mem_site_stats *sys_mem_site_stats(int i)
+{
+  if (i < 0 || i >= nsites)
+    return NULL;
+  return &site_stats[i];
 }
 
 
@@ -159,11 +864,28 @@ void *sys_alloc_mem(u32int size)
 */
 int sys_free_mem(void *ptr)
 {
+  int ret;
+
+  // arena objects go away with the arena; only the newest one
+  // can be given back early
+  if (arena_owns(ptr)) {
+    if ((unsigned char *) ptr + ((u32int *) ptr)[-1] == cop->pcb_arena_next)
+      cop->pcb_arena_next = (unsigned char *) ptr - sizeof(u32int);
+    return 0;
+  }
+
   //printf("sys_free_mem called\n");
-  if (mem_module_active)
-    return (*student_free)(ptr);
-  // otherwise we don't free anything
-  return -1;
+  if (buddy_owns((u32int) ptr))
+    ret = free_pages((u32int) ptr);
+  else if (mem_module_active)
+    ret = (*student_free)(ptr);
+  // otherwise it came from the kernel heap
+  else
+    ret = kfree((u32int) ptr);
+
+  if (ret == 0)
+    track_free((u32int) ptr);
+  return ret;
 }
 
 /*
@@ -175,15 +897,12 @@ int sys_free_mem(void *ptr)
 */
 void idle()
 {
-  char msg[30];
-  int count=0;
-	
-	memset( msg, '\0', sizeof(msg));
-	strcpy(msg, "IDLE PROCESS EXECUTING.\n");
-	count = strlen(msg);
-  
+  // runs whenever commhand waits for keys, so it stays quiet
   while(1){
-	sys_req( WRITE, DEFAULT_DEVICE, msg, &count);
+    // nothing else is ready; do a slice of upkeep, and once
+    // there is none left sleep until an interrupt brings work
+    if (idle_work == NULL || !(*idle_work)())
+      idle_sleep();
     sys_req(IDLE, DEFAULT_DEVICE, NULL, NULL);
   }
 }
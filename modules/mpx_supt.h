@@ -25,8 +25,42 @@
 #define INVALID_BUFFER 1000
 #define INVALID_COUNT 2000
 
-#define DEFAULT_DEVICE 111
-#define COM_PORT 222
+// devices for READ and WRITE
+#define DEFAULT_DEVICE 111 // terminal on COM1
+#define COM_PORT 222       // COM2
+#define COM3_PORT 333
+#define COM4_PORT 444
+
+// owner tags for sys_alloc_mem_tagged
+#define MEM_TAG_OTHER   0
+#define MEM_TAG_PCB     1
+#define MEM_TAG_ARGS    2
+#define MEM_TAG_HISTORY 3
+#define MEM_TAG_ALIAS   4
+#define MEM_TAG_ALARMS  5
+#define MEM_TAG_COUNT   6
+
+// allocation size histogram: <=16, <=32, ... <=1024, larger
+#define MEM_HIST_BUCKETS 8
+
+typedef struct {
+  u32int live_bytes;
+  u32int live_blocks;
+  u32int peak_bytes;
+  u32int allocs;
+  u32int frees;
+  u32int failed;
+  u32int untracked; // allocated while the tracking table was full
+  u32int hist[MEM_HIST_BUCKETS];
+} mem_tag_stats;
+
+typedef struct {
+  u32int site;  // return address of the allocating call
+  int tag;
+  u32int live_bytes;
+  u32int live_blocks;
+  u32int allocs;
+} mem_site_stats;
 
 typedef struct {
   int op_code;
@@ -64,6 +98,37 @@ void sys_set_malloc(u32int (*func)(u32int));
 */
 void sys_set_free(int (*func)(void *));
 
+/*
+  Procedure..: sys_set_resize
+  Description..: Sets the in place resize function for sys_realloc_mem
+  Params..: Function pointer; it returns the block size after
+			trying to resize, 0 for an unknown block
+*/
+void sys_set_resize(u32int (*func)(void *, u32int));
+
+/*
+  Procedure..: sys_set_calloc
+  Description..: Sets the zeroed allocation function for sys_calloc_mem
+  Params..: Function pointer
+*/
+void sys_set_calloc(u32int (*func)(u32int));
+
+/*
+  Procedure..: sys_set_aligned
+  Description..: Sets the aligned allocation function for sys_alloc_mem_aligned
+  Params..: Function pointer
+*/
+void sys_set_aligned(u32int (*func)(u32int, u32int));
+
+/*
+  Procedure..: sys_set_idle
+  Description..: Sets background work for the idle process to run
+			whenever it is dispatched. The function returns
+			nonzero while it has more work to do
+  Params..: Function pointer
+*/
+void sys_set_idle(int (*func)(void));
+
 /*
   Procedure..: sys_alloc_mem
   Description..: Allocates a block of memory (similar to malloc)
@@ -71,6 +136,107 @@ void sys_set_free(int (*func)(void *));
 */
 void *sys_alloc_mem(u32int size);
 
+/*
+  Procedure..: sys_alloc_mem_tagged
+  Description..: Allocates a block of memory and charges it to
+			an owner tag and the calling site for memprof
+  Params..: Number of bytes to allocate, one of MEM_TAG_*
+*/
+void *sys_alloc_mem_tagged(u32int size, int tag);
+
+/*
+  Procedure..: sys_alloc_mem_aligned
+  Description..: Allocates a block of memory whose address is a
+			multiple of align (16 for FXSAVE areas and stacks, 64
+			for cache lines, 4096 for pages). Freed with sys_free_mem.
+			NULL if align is 0 or not a power of two.
+  Params..: Number of bytes, alignment (a power of two), one of MEM_TAG_*
+*/
+void *sys_alloc_mem_aligned(u32int size, u32int align, int tag);
+
+/*
+  Procedure..: sys_realloc_mem
+  Description..: Resizes a block of memory (similar to realloc).
+			The block grows in place when the allocator can do
+			it; otherwise it is moved. Returns NULL, leaving the
+			old block alone, if no memory is left.
+  Params..: Block to resize (NULL allocates), new size in bytes
+			(0 frees)
+*/
+void *sys_realloc_mem(void *ptr, u32int size);
+
+/*
+  Procedure..: sys_calloc_mem
+  Description..: Allocates a zeroed array (similar to calloc).
+			Memory the allocator knows to be zero is not cleared again.
+  Params..: Number of elements, size of one element
+*/
+void *sys_calloc_mem(u32int count, u32int size);
+
+/*
+  Procedure..: sys_arena_init
+  Description..: Turns on arena mode for one tag of the current
+			process. size bytes of the private part of the process's
+			address space are reserved as a demand-zero region, giving
+			it a page directory of its own if it has none. From then
+			on the process's allocations with that tag are bumped out
+			of them and frees cost nothing. Allocations that don't
+			fit fall back to the heap. Other processes can't see the
+			arena, so it must not hold anything they are handed. Its
+			pages go with the directory when the process exits;
+			processes it creates share them copy-on-write.
+  Params..: Size of the arena in bytes, one of MEM_TAG_* other
+			than MEM_TAG_PCB
+  Returns..: 0 on success, -1 without a process, if arena mode is
+			already on, for MEM_TAG_PCB, if the arena doesn't fit in
+			the private window or if no directory or region is left
+*/
+int sys_arena_init(u32int size, int tag);
+
+/*
+  Procedure..: sys_arena_reset
+  Description..: Drops every allocation in the current process's
+			arena at once
+*/
+void sys_arena_reset();
+
+/*
+  Procedure..: sys_free_owner
+  Description..: Frees every block charged to a process
+  Params..: PCB of the process
+  Returns..: Number of blocks freed
+*/
+int sys_free_owner(void *owner);
+
+/*
+  Procedure..: sys_mem_tag_name
+  Description..: Name of an owner tag
+  Params..: One of MEM_TAG_*
+*/
+char *sys_mem_tag_name(int tag);
+
+/*
+  Procedure..: sys_mem_tag_of
+  Description..: Owner tag of a live block, -1 if not tracked
+  Params..: Pointer returned by sys_alloc_mem(_tagged)
+*/
+int sys_mem_tag_of(void *ptr);
+
+/*
+  Procedure..: sys_mem_tag_stats
+  Description..: Allocation counters of an owner tag
+  Params..: One of MEM_TAG_*
+*/
+mem_tag_stats *sys_mem_tag_stats(int tag);
+
+/*
+  Procedure..: sys_mem_site_stats
+  Description..: Allocation counters of the i-th call site,
+			NULL past the last recorded site
+  Params..: Site index
+*/
+mem_site_stats *sys_mem_site_stats(int i);
+
 /*
   Procedure..: sys_free_mem
   Description..: Frees memory
@@ -1,234 +1,535 @@
-// TODO: import the right stuff
+#include <system.h>
+#include <core/io.h>
+#include <core/serial.h>
+#include <core/tables.h>
 
-#define BASE COM1
+#include <core/trace.h>
+
+#include "driver.h"
 
 // some registers are used for more than one thing
 #define DIVISOR_LATCH_LOW_BYTE_REGISTER 0
 #define DIVISOR_LATCH_HIGH_BYTE_REGISTER 1
 #define INTERRUPT_ENABLE_REGISTER 1
 #define INTERRUPT_IDENTIFICATION_REGISTER 2
+#define FIFO_CONTROL_REGISTER 2
 #define LINE_CONTROL_REGISTER 3
 #define MODEM_CONTROL_REGISTER 4
 #define LINE_STATUS_REGISTER 5
 #define MODEM_STATUS_REGISTER 6
 #define SCRATCH_REGISTER 7
 
-#define PIC_MASK 0x21;
-
-#define RING_BUFFER_SIZE 100
-
-typedef enum {
-	OPEN,
-
-	CLOSED
-} device_ready_state_t;
-
-typedef enum {
-	IDLE,
-
-	READING,
-
-	WRITING
-} device_status_t;
-
-typedef struct dcb_t {
-	int *eflag_p;
-
-	device_ready_state_t ready_state;
+// interrupt enable register bits
+#define IER_RX   0x01
+#define IER_THRE 0x02
+
+// line status register bits
+#define LSR_DATA_READY 0x01
+#define LSR_THRE       0x20
+
+#define PIC_MASK 0x21
+#define PIC_EOI  0x20
+
+#define RING_MASK (RING_BUFFER_SIZE - 1)
+
+// the idt lives in tables.c
+extern idt_entry idt_entries[256];
+// stubs in irq.s that call com_isr with their irq line
+extern void serial_irq4_isr();
+extern void serial_irq3_isr();
+
+// one control block per port, with the irq line and handler it is wired to
+static dcb_t control_blocks[COM_PORT_COUNT] = {
+	{ .base = COM1, .irq = COM1_IRQ, .isr = serial_irq4_isr },
+	{ .base = COM2, .irq = COM2_IRQ, .isr = serial_irq3_isr },
+	{ .base = COM3, .irq = COM3_IRQ, .isr = serial_irq4_isr },
+	{ .base = COM4, .irq = COM4_IRQ, .isr = serial_irq3_isr },
+};
+
+// COM1 and COM3 share IRQ4, COM2 and COM4 share IRQ3, so the handler of a line is installed by
+// the first port on it to open and the old one put back when the last one closes
+static int irq_users[16];
+static idt_entry saved_vectors[16];
+
+/**
+ * Finds the control block of a port.
+ *
+ * @param port Base address of the port, COM1 to COM4
+ * @return The control block, or NULL for any other address
+ */
+static dcb_t *com_dcb(int port) {
+	int i;
+	for(i = 0; i < COM_PORT_COUNT; i++) {
+		if(control_blocks[i].base == port)
+			return &control_blocks[i];
+	}
+	return NULL;
+}
 
-	device_status_t oper_status;
+// keeps the compiler from moving ring accesses across an index update
+#define barrier() asm volatile ("" ::: "memory")
+// cli and sti with the same guarantee, for the short sections the handler must not split
+#define irq_disable() asm volatile ("cli" ::: "memory")
+#define irq_enable()  asm volatile ("sti" ::: "memory")
+
+/**
+ * Moves bytes from the pending write into the transmit ring until one of them runs out. Once the
+ * whole write is in the ring the request is complete.
+ */
+static void tx_fill(dcb_t *dcb) {
+	while(dcb->user_done < *dcb->user_count && dcb->tx_head - dcb->tx_tail < RING_BUFFER_SIZE) {
+		dcb->tx_ring[dcb->tx_head & RING_MASK] = dcb->user_buf[dcb->user_done++];
+		barrier();
+		dcb->tx_head++;
+	}
+	if(dcb->user_done == *dcb->user_count) {
+		dcb->oper_status = DEVICE_IDLE;
+		*(dcb->eflag_p) = 1;
+	}
+}
 
-	char *user_read_buf;
-	int *user_read_count;
+/**
+ * Refills the transmit FIFO from the ring. Only call this when the holding register is empty,
+ * with interrupts off or from the interrupt handler.
+ */
+static void tx_send(dcb_t *dcb) {
+	int n;
+	for(n = 0; n < TX_FIFO_SIZE && dcb->tx_tail != dcb->tx_head; n++) {
+		outb(dcb->base, dcb->tx_ring[dcb->tx_tail & RING_MASK]);
+		barrier();
+		dcb->tx_tail++;
+	}
 
-	char *user_write_buf;
-	int *user_write_count;
+	// the THRE interrupt is only wanted while there is something left to send
+	if(dcb->tx_tail != dcb->tx_head || dcb->oper_status == DEVICE_WRITING)
+		outb(dcb->base + INTERRUPT_ENABLE_REGISTER, IER_RX | IER_THRE);
+	else
+		outb(dcb->base + INTERRUPT_ENABLE_REGISTER, IER_RX);
+}
 
-	char ring_buffer[RING_BUFFER_SIZE];
-	int ring_buffer_head = 0;
-	int ring_buffer_tail = 0;
-} dcb_t;
+/**
+ * Starts the transmitter if it is sitting idle. When it is busy the THRE interrupt picks the new
+ * bytes up on its own.
+ */
+static void tx_kick(dcb_t *dcb) {
+	int on = irq_on();
+
+	irq_disable();
+	if(inb(dcb->base + LINE_STATUS_REGISTER) & LSR_THRE)
+		tx_send(dcb);
+	else
+		outb(dcb->base + INTERRUPT_ENABLE_REGISTER, IER_RX | IER_THRE);
+	if(on)
+		irq_enable();
+}
 
-const dcb_t *COM1_control_block = NULL;
+/**
+ * Moves received bytes from the ring into the pending read. Completes the read on a carriage
+ * return or once the count is reached.
+ */
+static void rx_fill(dcb_t *dcb) {
+	while(dcb->rx_tail != dcb->rx_head && dcb->user_done < *dcb->user_count) {
+		char next = dcb->rx_ring[dcb->rx_tail & RING_MASK];
+		barrier();
+		dcb->rx_tail++;
+
+		if(next == '\r' || next == '\n') {
+			dcb->user_buf[dcb->user_done] = '\0';
+			*(dcb->user_count) = dcb->user_done;
+			dcb->oper_status = DEVICE_IDLE;
+			*(dcb->eflag_p) = 1;
+			return;
+		}
+		dcb->user_buf[dcb->user_done++] = next;
+	}
+	if(dcb->user_done == *dcb->user_count) {
+		dcb->oper_status = DEVICE_IDLE;
+		*(dcb->eflag_p) = 1;
+	}
+}
 
-// return codes for all functions are defined by the r6 document
+int com_open(int port, int *eflag_p, int baud_rate) {
+	dcb_t *dcb = com_dcb(port);
 
-// TODO: disable interrupts at beginning, reenable at end?
-int com_open(int *eflag_p, int baud_rate) {
 	// 1.	Ensure that the parameters are valid, and that the device is not currently open.
+	if(dcb == NULL) {
+		return COM_OPEN_BAD_PORT;
+	}
 	if(eflag_p == NULL) {
-		return -101; // null event flag ptr
-	}
-	switch(baud_rate) {
-		// supported baud rates: 110, 150, 300, 600, 1200, 2400, 4800, 9600, and 19,200
-		// taken from max's glorious notes
-		case 110:
-		case 150:
-		case 300:
-		case 600:   // i dont think this is how youre supposed to program
-		case 1200:
-		case 2400:
-		case 4800:
-		case 9600:
-		case 19200:
-			break;
-		default:
-			return -102; // invalid baud rate divisor
+		return COM_OPEN_NULL_FLAG;
 	}
-	if(COM1_control_block != NULL && COM1_control_block->ready_state != CLOSED) {
-		return -103; // already open
+	// every standard rate from 50 to 115200 is supported
+	if(serial_divisor(baud_rate) == 0) {
+		return COM_OPEN_BAD_BAUD;
+	}
+	if(dcb->ready_state == OPEN) {
+		return COM_OPEN_ALREADY_OPEN;
+	}
+	// a missing uart reads back all ones instead of what was left in its scratch register
+	outb(dcb->base + SCRATCH_REGISTER, 0x5A);
+	if(inb(dcb->base + SCRATCH_REGISTER) != 0x5A) {
+		return COM_OPEN_BAD_PORT;
 	}
 
 	// 2.	Initialize the DCB. In particular, this should include indicating that the device is open, saving a copy of the event flag pointer, and setting the initial device status to idle. In addition, the ring buffer parameters must be initialized.
-	if(COM1_control_block == NULL) {
-		COM1_control_block = sys_alloc_mem(sizeof(dcb_t));
-	}
-	COM1_control_block->eflag_p = eflag_p;
-	COM1_control_block->ready_state = OPEN;
-	COM1_control_block->oper_status = IDLE;
-	COM1_control_block->user_read_buf = NULL;
-	COM1_control_block->user_read_count = NULL;
-	COM1_control_block->user_write_buf = NULL;
-	COM1_control_block->user_write_count = NULL;
-	COM1_control_block->ring_buffer_head = 0;
-	COM1_control_block->ring_buffer_tail = 0;
+	dcb->eflag_p = eflag_p;
+	dcb->ready_state = OPEN;
+	dcb->oper_status = DEVICE_IDLE;
+	dcb->user_buf = NULL;
+	dcb->user_count = NULL;
+	dcb->user_done = 0;
+	dcb->rx_head = 0;
+	dcb->rx_tail = 0;
+	dcb->rx_dropped = 0;
+	dcb->tx_head = 0;
+	dcb->tx_tail = 0;
 
 	// 3.	Save the address of the current interrupt handler, and install the new handler in the interrupt vector.
-	// TODO: this ^^^
+	irq_disable();
+	if(irq_users[dcb->irq]++ == 0) {
+		saved_vectors[dcb->irq] = idt_entries[COM_VECTOR(dcb->irq)];
+		idt_set_gate(COM_VECTOR(dcb->irq), (u32int)dcb->isr, 0x08, 0x8e);
+	}
 
 	// 4.	Compute the required baud rate divisor.
-	int baud_rate_divisor = 115200 / (long) baud_rate;
+	int baud_rate_divisor = serial_divisor(baud_rate);
 
 	// 5.	Store the value 0x80 in the Line Control Register. This allows the first two port addresses to access the Baud Rate Divisor register.
-	outb(BASE + LINE_CONTROL_REGISTER, 0x80);
+	outb(dcb->base + LINE_CONTROL_REGISTER, 0x80);
 
 	// 6.	Store the high order and low order bytes of the baud rate divisor into the MSB and LSB registers, respectively.
-	outb(BASE + DIVISOR_LATCH_LOW_BYTE_REGISTER, baud_rate_divisor & 0x00ff);
-	outb(BASE + DIVISOR_LATCH_HIGH_BYTE_REGISTER, baud_rate_divisor & 0xff00); // is this how you calculate "high order and low order bytes" i dont know lol
+	outb(dcb->base + DIVISOR_LATCH_LOW_BYTE_REGISTER, baud_rate_divisor & 0xff);
+	outb(dcb->base + DIVISOR_LATCH_HIGH_BYTE_REGISTER, (baud_rate_divisor >> 8) & 0xff);
 
-	// 7.	Store the value 0x03 in the Line Control Register. This sets the line characteristics to 8 data bits, 1 stop bit, and no parity. It also restores normal functioning of the first two ports. 
-	outb(BASE + LINE_CONTROL_REGISTER, 0x03);
+	// 7.	Store the value 0x03 in the Line Control Register. This sets the line characteristics to 8 data bits, 1 stop bit, and no parity. It also restores normal functioning of the first two ports.
+	outb(dcb->base + LINE_CONTROL_REGISTER, 0x03);
+
+	// enable and clear the FIFOs so one THRE interrupt can send TX_FIFO_SIZE bytes
+	outb(dcb->base + FIFO_CONTROL_REGISTER, 0xC7);
 
 	// 8.	Enable the appropriate level in the PIC mask register.
-	disable(); // example document had these function calls, not sure if they are needed or what they do
-	outb(PIC_MASK, inb(PIC_MASK) & ~0b1000); // PIC level for COM1 is 4, not sure if this is the right way to set it or not though
-	enable();
+	outb(PIC_MASK, inb(PIC_MASK) & ~(1 << dcb->irq));
 
-	// 9.	Enable overall serial port interrupts by storing the value 0x08 in the Modem Control register. 
-	outb(BASE + MODEM_CONTROL_REGISTER, 0x08);
+	// 9.	Enable overall serial port interrupts by storing the value 0x08 in the Modem Control register. DTR and RTS stay set.
+	outb(dcb->base + MODEM_CONTROL_REGISTER, 0x0B);
 
 	// 10.	Enable input ready interrupts only by storing the value 0x01 in the Interrupt Enable register.
-	outb(BASE + INTERRUPT_ENABLE_REGISTER, 0x01);
+	outb(dcb->base + INTERRUPT_ENABLE_REGISTER, IER_RX);
+
+	// drop anything left over from polling so the first interrupt is a fresh one
+	while(inb(dcb->base + LINE_STATUS_REGISTER) & LSR_DATA_READY)
+		(void)inb(dcb->base);
+	irq_enable();
 
 	return 0;
 }
 
-int com_close() {
+int com_close(int port) {
+	dcb_t *dcb = com_dcb(port);
+
 	// 1.	Ensure that the port is currently open.
-	if(COM1_control_block == NULL || COM1_control_block->ready_state != OPEN) {
-		return -201; // not open
+	if(dcb == NULL || dcb->ready_state != OPEN) {
+		return COM_CLOSE_NOT_OPEN;
 	}
 
 	// 2.	Clear the open indicator in the DCB.
-	COM1_control_block->ready_state = CLOSED;
+	irq_disable();
+	dcb->ready_state = CLOSED;
 
-	// 3.	Disable the appropriate level in the PIC mask register. 
-	// TODO
+	// 3.	Disable the appropriate level in the PIC mask register, unless another port still uses it.
+	irq_users[dcb->irq]--;
+	if(irq_users[dcb->irq] == 0)
+		outb(PIC_MASK, inb(PIC_MASK) | (1 << dcb->irq));
 
-	// 4.	Disable all interrupts in the ACC by loading zero values to the Modem Status register and the Interrupt Enable register.
-	outb(BASE + MODEM_STATUS_REGISTER, 0x0);
-	outb(BASE + INTERRUPT_ENABLE_REGISTER, 0x0);
+	// 4.	Disable all interrupts in the ACC by loading zero values to the Modem Control register and the Interrupt Enable register.
+	outb(dcb->base + MODEM_CONTROL_REGISTER, 0x0);
+	outb(dcb->base + INTERRUPT_ENABLE_REGISTER, 0x0);
 
-	// 5.	Restore the original saved interrupt vector. 
-	// TODO
+	// 5.	Restore the original saved interrupt vector.
+	if(irq_users[dcb->irq] == 0)
+		idt_entries[COM_VECTOR(dcb->irq)] = saved_vectors[dcb->irq];
+	irq_enable();
 
 	return 0;
 }
 
-int com_read(char *buf, int *count) {
+int com_set_baud(int port, int baud_rate) {
+	dcb_t *dcb = com_dcb(port);
+
+	if(dcb == NULL || dcb->ready_state != OPEN) {
+		return COM_BAUD_NOT_OPEN;
+	}
+	if(serial_divisor(baud_rate) == 0) {
+		return COM_BAUD_BAD_BAUD;
+	}
+
+	// let everything already queued go out at the old rate
+	while(1) {
+		irq_disable();
+		if(dcb->oper_status != DEVICE_WRITING && dcb->tx_tail == dcb->tx_head)
+			break;
+		asm volatile ("sti; hlt" ::: "memory");
+	}
+	set_serial_baud(dcb->base, baud_rate);
+	irq_enable();
+
+	return 0;
+}
+
+int com_read(int port, char *buf, int *count) {
+	dcb_t *dcb = com_dcb(port);
+	int on = irq_on();
+
 	// 1.	Validate the supplied parameters.
 	if(buf == NULL) {
-		return -302; // invalid buffer address
+		return COM_READ_BAD_BUFFER;
 	}
 	if(count == NULL || *count <= 0) {
-		return -303; // invalid count address or count value
+		return COM_READ_BAD_COUNT;
 	}
 
 	// 2.	Ensure that the port is open, and the status is idle.
-	if(COM1_control_block == NULL || COM1_control_block->ready_state != OPEN) {
-		return -301; // port not open
+	if(dcb == NULL || dcb->ready_state != OPEN) {
+		return COM_READ_NOT_OPEN;
 	}
-	if(COM1_control_block->oper_status != IDLE) {
-		return -304; // device busy
+	if(dcb->oper_status != DEVICE_IDLE) {
+		return COM_READ_BUSY;
 	}
 
-	// 3.	Initialize the input buffer variables (not the ring buffer!) and set the status to reading. 
-	int actual_count = 0;
-	COM1_control_block->oper_status = READING;
-
-	// 4.	Clear the caller's event flag. 
-	*(COM1_control_block->eflag_p) = 0; // is this what it means?
+	// 3.	Initialize the input buffer variables (not the ring buffer!) and set the status to reading.
+	dcb->user_buf = buf;
+	dcb->user_count = count;
+	dcb->user_done = 0;
+
+	// 4.	Clear the caller's event flag.
+	*(dcb->eflag_p) = 0;
+
+	// 5.	Copy characters from the ring buffer to the requestor's buffer, until the ring buffer is emptied, the requested count has been reached, or a CR (ENTER) code has been found. The copied characters should, of course, be removed from the ring buffer.
+	// The ring needs no lock, but the last check and the switch to DEVICE_READING must not be split by
+	// an interrupt or a byte could land in the ring after the handler started filling the buffer.
+	// io_start calls this from sys_call, so the interrupt flag is put back as it was.
+	rx_fill(dcb);
+	irq_disable();
+	rx_fill(dcb);
+
+	// 6.	If more characters are needed, return. If the block is complete, continue with step 7.
+	// 7.	Reset the DCB status to idle, set the event flag, and return the actual count to the requestor's variable.
+	// rx_fill has done step 7 if the read completed; otherwise the interrupt handler finishes it.
+	if(*(dcb->eflag_p) == 0)
+		dcb->oper_status = DEVICE_READING;
+	if(on)
+		irq_enable();
 
-	// 5.	Copy characters from the ring buffer to the requestor's buffer, until the ring buffer is emptied, the requested count has been reached, or a CR (ENTER) code has been found. The copied characters should, of course, be removed from the ring buffer. Either input interrupts or all interrupts should be disabled during the copying. 
-	outb(BASE + INTERRUPT_ENABLE_REGISTER, 0x0); // disable input interrupts TODO: this might clear the write interrupt bit and not reset it
+	return 0;
+}
 
-	while(actual_count < *count && COM1_control_block->ring_buffer_head != COM1_control_block->ring_buffer_tail) {
-		char next = COM1_control_block->ring_buffer[COM1_control_block->ring_buffer_head];
-		COM1_control_block->ring_buffer[COM1_control_block->ring_buffer_head] = '\0'; // I don't think this is actually necessary, but it says to do it
-		COM1_control_block->ring_buffer_head = COM1_control_block->ring_buffer_head == RING_BUFFER_SIZE - 1 ? 0 : COM1_control_block->ring_buffer_head + 1;
+int com_write(int port, char *buf, int *count) {
+	dcb_t *dcb = com_dcb(port);
+	int on = irq_on();
 
-		if(next == '\n')
-			break;
+	// 1.	Ensure that the input parameters are valid.
+	if(buf == NULL) {
+		return COM_WRITE_BAD_BUFFER;
+	}
+	if(count == NULL || *count <= 0) {
+		return COM_WRITE_BAD_COUNT;
+	}
 
-		buf[actual_count] = next;
-		actual_count++;
+	// 2.	Ensure that the port is currently open and idle.
+	if(dcb == NULL || dcb->ready_state != OPEN) {
+		return COM_WRITE_NOT_OPEN;
+	}
+	if(dcb->oper_status != DEVICE_IDLE) {
+		return COM_WRITE_BUSY;
 	}
 
-	outb(BASE + INTERRUPT_ENABLE_REGISTER, 0x1); // reenable input interrupts
+	// 3.	Install the buffer pointer and counters in the DCB, and set the current status to writing.
+	dcb->user_buf = buf;
+	dcb->user_count = count;
+	dcb->user_done = 0;
 
-	// 6.	If more characters are needed, return. If the block is complete, continue with step 7. 
-	if(actual_count < *count)
-		return;
+	// 4.	Clear the caller's event flag.
+	*(dcb->eflag_p) = 0;
+
+	// 5.	Get the first characters from the requestor's buffer and queue them for the transmitter.
+	// Until the status says DEVICE_WRITING only this function fills the ring, so the handler never sees
+	// a half finished request. Like com_read it leaves the interrupt flag as it found it.
+	tx_fill(dcb);
+	irq_disable();
+	tx_fill(dcb);
+	if(*(dcb->eflag_p) == 0)
+		dcb->oper_status = DEVICE_WRITING;
+	if(on)
+		irq_enable();
 
-	// 7.	Reset the DCB status to idle, set the event flag, and return the actual count to the requestor's variable. 
-	COM1_control_block->oper_status = IDLE;
-	*(COM1_control_block->eflag_p) = 1; // again, not sure what it wants here but i think its this
-	*count = actual_count;
-	// TODO: should we be nice and null-terminate the caller's buffer before returning? or will that break something
+	// 6.	Enable write interrupts by setting bit 1 of the Interrupt Enable register.
+	tx_kick(dcb);
 
 	return 0;
 }
 
-int com_write(char *buf, int *count) {
-	// 1.	Ensure that the input parameters are valid.
-	if(buf == NULL) {
-		return -402; // invalid buffer address
+void com_abort(int port) {
+	dcb_t *dcb = com_dcb(port);
+	int on = irq_on();
+
+	if(dcb == NULL) {
+		return;
 	}
-	if(count == NULL || *count <= 0) {
-		return -403; // invalid count address or count value
+
+	// may be called from sys_call, so leave the interrupt flag as it was
+	irq_disable();
+	dcb->oper_status = DEVICE_IDLE;
+	dcb->user_buf = NULL;
+	dcb->user_count = NULL;
+	dcb->user_done = 0;
+	if(on)
+		irq_enable();
+}
+
+int com_getc(int port) {
+	dcb_t *dcb = com_dcb(port);
+	char c;
+
+	if(dcb == NULL || dcb->rx_tail == dcb->rx_head)
+		return -1;
+	c = dcb->rx_ring[dcb->rx_tail & RING_MASK];
+	barrier();
+	dcb->rx_tail++;
+	return (unsigned char)c;
+}
+
+int com_rx_pending(int port) {
+	dcb_t *dcb = com_dcb(port);
+	return dcb != NULL && dcb->rx_tail != dcb->rx_head;
+}
+
+void com_wait_rx(int port) {
+	dcb_t *dcb = com_dcb(port);
+
+	if(dcb == NULL || dcb->ready_state != OPEN)
+		return;
+	irq_disable();
+	if(dcb->rx_tail == dcb->rx_head)
+		asm volatile ("sti; hlt" ::: "memory");
+	else
+		irq_enable();
+}
+
+void com_putc(int port, char c) {
+	dcb_t *dcb = com_dcb(port);
+
+	if(dcb == NULL || dcb->ready_state != OPEN)
+		return;
+
+	// bytes of a pending write go first, and the handler is the producer until it is done
+	while(1) {
+		irq_disable();
+		if(dcb->oper_status != DEVICE_WRITING && dcb->tx_head - dcb->tx_tail < RING_BUFFER_SIZE)
+			break;
+		asm volatile ("sti; hlt" ::: "memory");
 	}
+	irq_enable();
+
+	dcb->tx_ring[dcb->tx_head & RING_MASK] = c;
+	barrier();
+	dcb->tx_head++;
+	tx_kick(dcb);
+}
 
-	// 2.	Ensure that the port is currently open and idle. 
-	if(COM1_control_block == NULL || COM1_control_block->ready_state != OPEN) {
-		return -401; // serial port not open
+int com_try_write(int port, const char *buf, int len) {
+	dcb_t *dcb = com_dcb(port);
+	int i, busy, on = irq_on();
+
+	if(dcb == NULL || dcb->ready_state != OPEN) {
+		return COM_WRITE_NOT_OPEN;
 	}
-	if(COM1_control_block->oper_status != IDLE) {
-		return -404; // device busy
+
+	// only the handler moves tx_tail, and that only makes more room
+	irq_disable();
+	busy = dcb->oper_status == DEVICE_WRITING || RING_BUFFER_SIZE - (dcb->tx_head - dcb->tx_tail) < (u32int)len;
+	if(on)
+		irq_enable();
+	if(busy)
+		return 0;
+
+	for(i = 0; i < len; i++) {
+		dcb->tx_ring[dcb->tx_head & RING_MASK] = buf[i];
+		barrier();
+		dcb->tx_head++;
 	}
+	tx_kick(dcb);
+	return len;
+}
+
+void com_sleep(volatile int *flag) {
+	// sti only takes effect after the next instruction, so an interrupt
+	// that sets the flag cannot slip in between the check and the hlt
+	irq_disable();
+	if(*flag == 0)
+		asm volatile ("sti; hlt" ::: "memory");
+	else
+		irq_enable();
+}
+
+int com_irq(int port) {
+	dcb_t *dcb = com_dcb(port);
+	return dcb != NULL ? dcb->irq : -1;
+}
 
-	// 3.	Install the buffer pointer and counters in the DCB, and set the current status to writing. 
-	COM1_control_block->user_write_buf = buf;
-	COM1_control_block->user_write_count = count;
-	COM1_control_block->oper_status = WRITING;
+int com_is_open(int port) {
+	dcb_t *dcb = com_dcb(port);
+	return dcb != NULL && dcb->ready_state == OPEN;
+}
 
-	// 4.	Clear the caller's event flag. 
-	*(COM1_control_block->eflag_p) = 0;
+/**
+ * Serves everything one port has pending.
+ */
+static void com_service(dcb_t *dcb) {
+	u8int iir;
+
+	// keep serving until the uart has nothing pending
+	while(!((iir = inb(dcb->base + INTERRUPT_IDENTIFICATION_REGISTER)) & 0x01)) {
+		switch(iir & 0x0E) {
+			case 0x00: // modem status changed
+				(void)inb(dcb->base + MODEM_STATUS_REGISTER);
+				break;
+			case 0x02: // transmit holding register empty
+				if(dcb->oper_status == DEVICE_WRITING)
+					tx_fill(dcb);
+				tx_send(dcb);
+				break;
+			case 0x04: // received data
+			case 0x0C: // character timeout, data is still waiting in the FIFO
+				while(inb(dcb->base + LINE_STATUS_REGISTER) & LSR_DATA_READY) {
+					char c = inb(dcb->base);
+					if(dcb->rx_head - dcb->rx_tail == RING_BUFFER_SIZE) {
+						dcb->rx_dropped++;
+						continue;
+					}
+					dcb->rx_ring[dcb->rx_head & RING_MASK] = c;
+					barrier();
+					dcb->rx_head++;
+				}
+				if(dcb->oper_status == DEVICE_READING)
+					rx_fill(dcb);
+				break;
+			case 0x06: // line status; reading it clears the error
+				(void)inb(dcb->base + LINE_STATUS_REGISTER);
+				break;
+		}
+	}
+}
 
-	// 5.	Get the first character from the requestor's buffer and store it in the output register. 
-	outb(BASE, buf[0]);
+void com_isr(int irq) {
+	int i;
 
-	// 6.	Enable write interrupts by setting bit 1 of the Interrupt Enable register. This must be done by setting the register to the logical or of its previous contents and 0x02.
-	outb(BASE + INTERRUPT_ENABLE_REGISTER, inb(BASE + INTERRUPT_ENABLE_REGISTER) | 0x02);
+	TRACE(TRACE_IRQ, irq, 0, 0);
+	// the line may be shared, so every open port on it gets a look
+	for(i = 0; i < COM_PORT_COUNT; i++) {
+		if(control_blocks[i].irq == irq && control_blocks[i].ready_state == OPEN)
+			com_service(&control_blocks[i]);
+	}
+	TRACE(TRACE_IRQ_END, irq, 0, 0);
 
-	return 0;
+	outb(PIC_EOI, PIC_EOI);
 }
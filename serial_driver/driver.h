@@ -0,0 +1,235 @@
+#ifndef _DRIVER_H
+#define _DRIVER_H
+
+#include <system.h>
+
+/// Number of ports in the device table, COM1 to COM4
+#define COM_PORT_COUNT 4
+
+/// IRQ lines of the ports on the master PIC. COM1 and COM3 share one line, COM2 and COM4 the other
+#define COM1_IRQ 4
+#define COM2_IRQ 3
+#define COM3_IRQ 4
+#define COM4_IRQ 3
+/// Interrupt vector of an IRQ line once the PIC has been remapped to 0x20
+#define COM_VECTOR(irq) (0x20 + (irq))
+
+/// Size of the receive and transmit rings. Must be a power of two
+#define RING_BUFFER_SIZE 256
+
+/// Bytes the transmit FIFO takes at once after a THRE interrupt
+#define TX_FIFO_SIZE 16
+
+// return codes for all functions are defined by the r6 document
+#define COM_OPEN_NULL_FLAG     -101
+#define COM_OPEN_BAD_BAUD      -102
+#define COM_OPEN_ALREADY_OPEN  -103
+#define COM_OPEN_BAD_PORT      -104
+
+#define COM_CLOSE_NOT_OPEN     -201
+
+#define COM_READ_NOT_OPEN      -301
+#define COM_READ_BAD_BUFFER    -302
+#define COM_READ_BAD_COUNT     -303
+#define COM_READ_BUSY          -304
+
+#define COM_WRITE_NOT_OPEN     -401
+#define COM_WRITE_BAD_BUFFER   -402
+#define COM_WRITE_BAD_COUNT    -403
+#define COM_WRITE_BUSY         -404
+
+#define COM_BAUD_NOT_OPEN      -501
+#define COM_BAUD_BAD_BAUD      -502
+
+/// CLOSED comes first so a zeroed control block starts out closed
+typedef enum {
+	CLOSED,
+
+	OPEN
+} device_ready_state_t;
+
+/// Prefixed so they don't collide with the sys_req op codes
+typedef enum {
+	DEVICE_IDLE,
+
+	DEVICE_READING,
+
+	DEVICE_WRITING
+} device_status_t;
+
+/**
+ * Device control block of a serial port. The driver keeps one for each of COM1 to COM4.
+ *
+ * Both rings have a single producer and a single consumer, so they need no lock. The interrupt
+ * handler moves rx_head and tx_tail, everything else moves rx_tail and tx_head. While a request
+ * is DEVICE_READING or DEVICE_WRITING the handler also takes over the other end of that ring.
+ * The indexes run freely and are masked on access, so head - tail is the number of bytes held.
+ */
+typedef struct dcb_t {
+	/// Base I/O address of the port
+	int base;
+	/// IRQ line the port raises
+	int irq;
+	/// Stub in irq.s installed for that line
+	void (*isr)();
+
+	/// Set to 1 when a read or write request completes
+	int *eflag_p;
+
+	device_ready_state_t ready_state;
+
+	volatile device_status_t oper_status;
+
+	/// Request being served by the interrupt handler while the status is DEVICE_READING or DEVICE_WRITING
+	char *user_buf;
+	int *user_count;
+	int user_done;
+
+	/// Received bytes no read request was waiting for
+	char rx_ring[RING_BUFFER_SIZE];
+	volatile u32int rx_head;
+	volatile u32int rx_tail;
+	/// Bytes lost because the receive ring was full
+	u32int rx_dropped;
+
+	/// Bytes waiting for the transmitter
+	char tx_ring[RING_BUFFER_SIZE];
+	volatile u32int tx_head;
+	volatile u32int tx_tail;
+} dcb_t;
+
+/**
+ * Opens a port for interrupt driven I/O and installs the handler of its IRQ line.
+ *
+ * @param port Base address of the port, COM1 to COM4
+ * @param eflag_p Event flag set when a read or write completes
+ * @param baud_rate Any standard rate from 50 to 115200, see serial_divisor
+ * @return 0 on success or one of the COM_OPEN_* codes. COM_OPEN_BAD_PORT also means no uart answered
+ */
+int com_open(int port, int *eflag_p, int baud_rate);
+
+/**
+ * Closes a port. The interrupt handler com_open replaced is put back once no port uses the line.
+ *
+ * @param port Base address of the port
+ * @return 0 on success or COM_CLOSE_NOT_OPEN
+ */
+int com_close(int port);
+
+/**
+ * Switches the open port to another baud rate once everything queued for sending has gone out
+ * at the old one. Bytes received while the divisor changes may be garbled.
+ *
+ * @param port Base address of the port
+ * @param baud_rate Any standard rate from 50 to 115200, see serial_divisor
+ * @return 0 on success or one of the COM_BAUD_* codes
+ */
+int com_set_baud(int port, int baud_rate);
+
+/**
+ * Starts reading up to *count bytes, stopping early at a carriage return. Bytes already received
+ * are taken from the ring; the rest are delivered by the interrupt handler. The event flag is set
+ * and *count holds the number of bytes read once the request completes.
+ *
+ * @param port Base address of the port
+ * @param buf Buffer to read into
+ * @param count Number of bytes wanted; receives the number of bytes read
+ * @return 0 if the request was started or completed, or one of the COM_READ_* codes
+ */
+int com_read(int port, char *buf, int *count);
+
+/**
+ * Starts writing *count bytes. The bytes are moved into the transmit ring as space frees up and
+ * sent from the THRE interrupt. The event flag is set once every byte is in the ring, after which
+ * the buffer may be reused.
+ *
+ * @param port Base address of the port
+ * @param buf Bytes to send
+ * @param count Number of bytes to send
+ * @return 0 if the request was started or completed, or one of the COM_WRITE_* codes
+ */
+int com_write(int port, char *buf, int *count);
+
+/**
+ * Abandons the read or write in progress. The driver stops touching the request's buffer and
+ * count, and its event flag is not set. Bytes already in the transmit ring still go out.
+ *
+ * @param port Base address of the port
+ */
+void com_abort(int port);
+
+/**
+ * Takes the next byte from the receive ring.
+ *
+ * @param port Base address of the port
+ * @return The byte, or -1 if nothing has been received
+ */
+int com_getc(int port);
+
+/**
+ * Checks whether the receive ring holds any bytes.
+ *
+ * @param port Base address of the port
+ * @return 1 if a byte is waiting, 0 otherwise
+ */
+int com_rx_pending(int port);
+
+/**
+ * Halts the cpu until the next interrupt unless a byte is already waiting in the receive ring.
+ *
+ * @param port Base address of the port
+ */
+void com_wait_rx(int port);
+
+/**
+ * Queues a byte behind any pending write, sleeping while the transmit ring is full.
+ *
+ * @param port Base address of the port
+ * @param c Byte to send
+ */
+void com_putc(int port, char c);
+
+/**
+ * Queues bytes behind any pending output if they all fit in the transmit ring right now. Never
+ * sleeps, so the idle process can use it.
+ *
+ * @param port Base address of the port
+ * @param buf Bytes to send
+ * @param len Number of bytes to send
+ * @return len if they were queued, 0 if there was no room, or COM_WRITE_NOT_OPEN
+ */
+int com_try_write(int port, const char *buf, int len);
+
+/**
+ * Halts the cpu until the next interrupt if *flag is still 0. Returns at once otherwise.
+ *
+ * @param flag Flag to wait on
+ */
+void com_sleep(volatile int *flag);
+
+/**
+ * Looks up the IRQ line a port is wired to.
+ *
+ * @param port Base address of the port
+ * @return The line, or -1 for an unknown port
+ */
+int com_irq(int port);
+
+/**
+ * Checks whether a port is open for interrupt driven I/O.
+ *
+ * @param port Base address of the port
+ * @return 1 if it is open, 0 otherwise
+ */
+int com_is_open(int port);
+
+/**
+ * Interrupt handler for IRQ3 and IRQ4, called from the serial_irq3_isr and serial_irq4_isr stubs.
+ * For every open port on the line it moves received bytes to the pending read or the receive ring
+ * and refills the transmit FIFO.
+ *
+ * @param irq The line that fired
+ */
+void com_isr(int irq);
+
+#endif
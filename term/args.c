@@ -24,7 +24,7 @@ void stack_pop();
 
 // returned args needs freed when done with
 parsed_args *parse_args(char *arg_str) {
-	parsed_args *args = (parsed_args *)sys_alloc_mem(sizeof(parsed_args));
+	parsed_args *args = (parsed_args *)sys_alloc_mem_tagged(sizeof(parsed_args), MEM_TAG_ARGS);
 	memset(args, '\0', sizeof(parsed_args));
 	skip_ws(&arg_str);
 	
@@ -0,0 +1,89 @@
+#include <lib/out.h>
+#include <term/args.h>
+#include <core/klog.h>
+#include <modules/mpx_supt.h>
+
+/**
+ * Checks whether text appears anywhere in str.
+ */
+static int dmesg_contains(const char *str, const char *text) {
+	int i, j;
+	for(i = 0; str[i] != '\0'; i++) {
+		for(j = 0; text[j] != '\0' && str[i + j] == text[j]; j++);
+		if(text[j] == '\0')
+			return 1;
+	}
+	return text[0] == '\0';
+}
+
+/**
+ * Checks whether an entry passes the level and text filters of dmesg.
+ */
+static int dmesg_match(klog_entry *e, int level, char *text) {
+	return e->level >= level && (text == NULL || dmesg_contains(e->msg, text));
+}
+
+/**
+ * Handler for the dmesg command. Prints the entries still held in the kernel log, oldest first.
+ * -l LEVEL leaves out entries below LEVEL, -g TEXT keeps only entries containing TEXT and -n COUNT
+ * shows just the last COUNT entries left after that. -c LEVEL sets the least important level the
+ * idle process writes to the console, and --clear empties the log after printing it.
+ *
+ * @param arg_str The arguments passed to the dmesg command.
+ *
+ * @return The exit code of the command, 0 on success or 1 for a bad argument.
+ */
+int cmd_dmesg(char *arg_str) {
+	parsed_args *args = parse_args(arg_str);
+	if(args == NULL)
+		return 1;
+
+	char *val, *text = NULL;
+	char line[KLOG_MSG_SIZE + 24];
+	int level = KLOG_DEBUG, count = -1, matches = 0, ret = 0;
+	klog_entry e;
+	u32int i, start, end;
+
+	if(named_arg(args, "l", &val) && (level = klog_level(val)) < 0) {
+		printf("Error: Unknown level %s. Levels are debug, info, warn, err and panic\n", val);
+		ret = 1;
+	}
+	if(named_arg(args, "c", &val)) {
+		int console = klog_level(val);
+		if(console < 0) {
+			printf("Error: Unknown level %s. Levels are debug, info, warn, err and panic\n", val);
+			ret = 1;
+		} else {
+			klog_console_level = console;
+		}
+	}
+	if(named_arg(args, "n", &val))
+		count = atoi(val);
+	named_arg(args, "g", &text);
+
+	if(ret == 0) {
+		start = klog_start();
+		end = klog_end();
+
+		// with -n, skip everything but the last count matches
+		if(count >= 0) {
+			for(i = start; i != end; i++)
+				if(klog_get(i, &e) && dmesg_match(&e, level, text))
+					matches++;
+		}
+		for(i = start; i != end; i++) {
+			if(!klog_get(i, &e) || !dmesg_match(&e, level, text))
+				continue;
+			if(count >= 0 && matches-- > count)
+				continue;
+			klog_format(&e, line, sizeof(line));
+			print(line, strlen(line));
+		}
+
+		if(flag(args, "clear"))
+			klog_clear();
+	}
+
+	sys_free_mem(args);
+	return ret;
+}
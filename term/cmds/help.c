@@ -1,4 +1,5 @@
 #include <lib/out.h>
+#include <term/pcb/pcb.h>
 
 
 int cmd_help(char *command) {
@@ -51,6 +52,10 @@ int cmd_help(char *command) {
 		showblockedpcbHelp();
 		return 1;
 	}
+	else if (strcmp(command, " showstackpcb") == 0) {
+		showstackpcbHelp();
+		return 1;
+	}
 	else if (strcmp(command, " setprioritypcb") == 0) {
 		setpriorityHelp();
 		return 1;
@@ -95,10 +100,30 @@ int cmd_help(char *command) {
 		isemptyHelp();
 		return 1;
 	}
+	else if (strcmp(command, " heapcheck") == 0) {
+		heapcheckHelp();
+		return 1;
+	}
+	else if (strcmp(command, " memprof") == 0) {
+		memprofHelp();
+		return 1;
+	}
 	else if (strcmp(command, " clear") == 0) {
 		clearHelp();
 		return 1;
 	}
+	else if (strcmp(command, " setbaud") == 0) {
+		setbaudHelp();
+		return 1;
+	}
+	else if (strcmp(command, " dmesg") == 0) {
+		dmesgHelp();
+		return 1;
+	}
+	else if (strcmp(command, " trace") == 0) {
+		traceHelp();
+		return 1;
+	}
 	else if (strcmp(command, " alias") == 0) {
 		aliasHelp();
 		return 1;
@@ -126,11 +151,12 @@ void helpList() {
 		  " | help     | | getdate  | | showpcb        | | setalarm   | | showalloc  |\n"
 		  " | version  | | setdate  | | showallpcb     | | showalarms | | showfree   |\n"
 		  " | shutdown | | gettime  | | showreadypcb   | | freealarm  | | isempty    |\n"
-		  " | clear    | | settime  | | showblockedpcb | -------------- --------------\n"
-		  " | alias    | ------------ | setprioritypcb |\n"
-		  " ------------              | resumepcb      |\n"
-		  "                           | suspendpcb     |\n"
-		  "                           | resumeallpcb   |\n"
+		  " | clear    | | settime  | | showblockedpcb | -------------- | memprof    |\n"
+		  " | alias    | ------------ | setprioritypcb |                | heapcheck  |\n"
+		  " | setbaud  |              | resumepcb      |                --------------\n"
+		  " | dmesg    |              | suspendpcb     |\n"
+		  " | trace    |              | resumeallpcb   |\n"
+		  " ------------              | showstackpcb   |\n"
 		  "                           | loadr3         |\n"
 		  "                           ------------------\n",191);
 }
@@ -317,6 +343,19 @@ void showblockedpcbHelp() {
 		  "showblockedpcb\n\n",1);
 }
 
+void showstackpcbHelp() {
+	printf("NAME\n\t"
+		   "showstackpcb\n\n"
+		   "USAGE\n\t"
+		   "showstackpcb [name]\n\n"
+		   "DESCRIPTION\n\t"
+		   "Display the peak stack usage of a PCB, or of the running PCB and every PCB in the Ready and Blocked\n\t"
+		   "queues when no name is given. Stacks are filled with a known pattern when the PCB is dispatched, so\n\t"
+		   "the peak is the deepest the stack has ever been. Stacks at %i%% or more are marked as near overflow\n\n"
+		   "EXAMPLE\n\t"
+		   "showstackpcb commhand\n\n", STACK_WARN_PERCENT);
+}
+
 void blockHelp() {
 	print("NAME\n\t"
 		  "blockpcb\n\n"
@@ -459,4 +498,76 @@ void isemptyHelp() {
 		   "isempty\n\n"
 		   "DESCRIPTION\n\t"
 		   "Shows whether the heap is entirely free memory.\n\n");
-}
\ No newline at end of file
+}
+
+void heapcheckHelp() {
+	printf("NAME\n\t"
+		   "heapcheck\n\n"
+		   "USAGE\n\t"
+		   "heapcheck\n\t"
+		   "heapcheck -k [BLOCKS]\n\t"
+		   "heapcheck --poison | --nopoison\n\n"
+		   "DESCRIPTION\n\t"
+		   "With no arguments, walks every block of the heap and checks its header and its links in the allocated\n\t"
+		   "or free list. -k checks that many blocks on every scheduler tick instead; 0 turns this off. Incremental\n\t"
+		   "checking stops after the first problem. --poison fills free blocks with a fixed pattern so writes to\n\t"
+		   "freed memory are caught by later checks.\n\n"
+		   "EXAMPLE\n\t"
+		   "heapcheck -k 4\n\n");
+}
+
+void memprofHelp() {
+	printf("NAME\n\t"
+		   "memprof\n\n"
+		   "USAGE\n\t"
+		   "memprof\n\n"
+		   "DESCRIPTION\n\t"
+		   "Shows the live bytes, peak, allocation count and size histogram of each memory owner (pcb, args,\n\t"
+		   "history, alias, alarms, other), followed by every call site that still holds memory. The allocation\n\t"
+		   "rate is measured since the previous memprof run.\n\n");
+}
+
+void setbaudHelp() {
+	printf("NAME\n\t"
+		   "setbaud\n\n"
+		   "USAGE\n\t"
+		   "setbaud [RATE] [PORT]\n\n"
+		   "DESCRIPTION\n\t"
+		   "Switches PORT (COM1 to COM4, COM1 if left out) to RATE baud once pending output has been sent. Any\n\t"
+		   "standard rate from 50 to 115200 is accepted. The terminal on the other end must be switched to the\n\t"
+		   "same rate. With no RATE, shows the current rate of the port.\n\n"
+		   "EXAMPLE\n\t"
+		   "setbaud 115200 com2\n\n");
+}
+
+void dmesgHelp() {
+	printf("NAME\n\t"
+		   "dmesg\n\n"
+		   "USAGE\n\t"
+		   "dmesg [-l LEVEL] [-g TEXT] [-n COUNT] [--clear]\n\t"
+		   "dmesg -c LEVEL\n\n"
+		   "DESCRIPTION\n\t"
+		   "Prints the kernel log, oldest entry first, with the time since boot and the level of each entry.\n\t"
+		   "Levels are debug, info, warn, err and panic. -l leaves out entries below LEVEL, -g keeps only the\n\t"
+		   "entries containing TEXT and -n shows the last COUNT entries that are left. --clear empties the log\n\t"
+		   "afterwards. -c sets the least important level that is also written to the console as it is logged.\n\n"
+		   "EXAMPLE\n\t"
+		   "dmesg -l warn -n 10\n\n");
+}
+
+void traceHelp() {
+	printf("NAME\n\t"
+		   "trace\n\n"
+		   "USAGE\n\t"
+		   "trace --start [-p PORT]\n\t"
+		   "trace --stop\n\t"
+		   "trace\n\n"
+		   "DESCRIPTION\n\t"
+		   "Streams scheduler, I/O, interrupt and heap events as binary records to COM2, or to COM PORT, at\n\t"
+		   "115200 baud. Run QEMU with -serial file:trace.bin as the second serial port to capture them, then\n\t"
+		   "turn the file into CSV or Chrome trace JSON with the tracedec tool (make tracedec). With no\n\t"
+		   "arguments, shows how many records were taken, sent and dropped. While the stream runs, READ and\n\t"
+		   "WRITE requests for that port are refused so nothing else lands in it.\n\n"
+		   "EXAMPLE\n\t"
+		   "trace --start -p 2\n\n");
+}
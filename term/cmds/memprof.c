@@ -0,0 +1,95 @@
+#include <lib/out.h>
+#include <core/io.h>
+#include <modules/mpx_supt.h>
+#include <term/dnt/dnt.h>
+
+/// Allocation counts per tag at the previous memprof run, used for the rate
+static u32int memprof_last_allocs[MEM_TAG_COUNT];
+/// RTC time of the previous memprof run in seconds since midnight, -1 before the first run
+static int memprof_last_time = -1;
+
+/**
+ * Reads the RTC and returns the number of seconds since midnight.
+ */
+static int memprof_now() {
+	int hour, minute, second;
+
+	outb(0x70, 0x04);
+	hour = BCDtoI(inb(0x71));
+	outb(0x70, 0x02);
+	minute = BCDtoI(inb(0x71));
+	outb(0x70, 0x00);
+	second = BCDtoI(inb(0x71));
+
+	return (hour * 60 + minute) * 60 + second;
+}
+
+/**
+ * Handler for the memprof command. Prints the live bytes, peak, allocation count, allocation
+ * rate and size histogram of every owner tag, followed by the call sites holding memory.
+ * The rate covers the time since the previous memprof run.
+ *
+ * @param arg_str The arguments passed to the memprof command. Unused by the handler.
+ *
+ * @return The exit code of the command, always 0.
+ */
+int cmd_memprof(char *arg_str) {
+	(void)arg_str;
+
+	int now = memprof_now();
+	int elapsed = -1;
+	if(memprof_last_time >= 0) {
+		elapsed = now - memprof_last_time;
+		if(elapsed < 0)
+			elapsed += 24 * 60 * 60; // passed midnight
+	}
+	memprof_last_time = now;
+
+	int tag, b;
+	for(tag = 0; tag < MEM_TAG_COUNT; tag++) {
+		mem_tag_stats *stats = sys_mem_tag_stats(tag);
+		u32int recent = stats->allocs - memprof_last_allocs[tag];
+		memprof_last_allocs[tag] = stats->allocs;
+
+		printf("%s: %i bytes live in %i blocks, peak %i bytes, %i allocs, %i frees",
+			sys_mem_tag_name(tag), stats->live_bytes, stats->live_blocks,
+			stats->peak_bytes, stats->allocs, stats->frees);
+		if(stats->failed > 0)
+			printf(", %i failed", stats->failed);
+		if(stats->untracked > 0)
+			printf(", %i untracked", stats->untracked);
+		if(elapsed > 0)
+			printf(", %i allocs/min", recent * 60 / elapsed);
+		else if(elapsed == 0)
+			printf(", %i allocs since last run", recent);
+		printf("\n");
+
+		if(stats->allocs == 0)
+			continue;
+		printf("\tsizes:");
+		for(b = 0; b < MEM_HIST_BUCKETS; b++) {
+			if(stats->hist[b] == 0)
+				continue;
+			if(b < MEM_HIST_BUCKETS - 1)
+				printf(" <=%i:%i", 16 << b, stats->hist[b]);
+			else
+				printf(" >%i:%i", 16 << (b - 1), stats->hist[b]);
+		}
+		printf("\n");
+	}
+
+	printf("\nCall sites holding memory:\n");
+	int i, shown = 0;
+	mem_site_stats *site;
+	for(i = 0; (site = sys_mem_site_stats(i)) != NULL; i++) {
+		if(site->live_blocks == 0)
+			continue;
+		printf("\t%x (%s): %i bytes live in %i blocks, %i allocs\n", site->site,
+			sys_mem_tag_name(site->tag), site->live_bytes, site->live_blocks, site->allocs);
+		shown++;
+	}
+	if(shown == 0)
+		printf("\tnone\n");
+
+	return 0;
+}
@@ -0,0 +1,62 @@
+#include <lib/out.h>
+#include <core/serial.h>
+#include <serial_driver/driver.h>
+
+/// Base addresses of COM1 to COM4, indexed by port number - 1
+static int setbaud_ports[COM_PORT_COUNT] = { COM1, COM2, COM3, COM4 };
+
+/**
+ * Handler for the setbaud command. With no rate it prints the rate the port is running at,
+ * otherwise it switches the port to the given rate. The port is COM1 unless a second argument
+ * such as com2 names another one. The terminal on the other end has to be switched to the same
+ * rate afterwards.
+ *
+ * @param arg_str The arguments passed to the setbaud command: the new rate and the port, both optional.
+ *
+ * @return The exit code of the command, 0 on success or 1 for a bad rate or port.
+ */
+int cmd_setbaud(char *arg_str) {
+	int baud = 0, num = 1, port, ret;
+
+	while(*arg_str == ' ')
+		arg_str++;
+	while(*arg_str >= '0' && *arg_str <= '9')
+		baud = baud * 10 + (*arg_str++ - '0');
+	while(*arg_str == ' ')
+		arg_str++;
+	if((arg_str[0] == 'c' || arg_str[0] == 'C') && (arg_str[1] == 'o' || arg_str[1] == 'O')
+			&& (arg_str[2] == 'm' || arg_str[2] == 'M')) {
+		num = arg_str[3] - '0';
+		arg_str += 4;
+		while(*arg_str == ' ')
+			arg_str++;
+	}
+
+	if(*arg_str != '\0' || num < 1 || num > COM_PORT_COUNT) {
+		printf("Error: Usage is setbaud [RATE] [COM1-COM4]\n");
+		return 1;
+	}
+	port = setbaud_ports[num - 1];
+
+	if(baud == 0) {
+		printf("COM%i is running at %i baud\n", num, get_serial_baud(port));
+		return 0;
+	}
+	if(serial_divisor(baud) == 0) {
+		printf("Error: Unsupported baud rate. Supported rates are 50, 75, 110, 150, 300, 600, 1200,\n"
+			   "1800, 2400, 4800, 9600, 19200, 38400, 57600 and 115200\n");
+		return 1;
+	}
+
+	printf("Switching COM%i to %i baud\n", num, baud);
+	flush();
+	if(com_is_open(port))
+		ret = com_set_baud(port, baud);
+	else
+		ret = set_serial_baud(port, baud);
+	if(ret != 0) {
+		printf("Error: Could not change the baud rate (%i)\n", ret);
+		return 1;
+	}
+	return 0;
+}
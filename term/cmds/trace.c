@@ -0,0 +1,60 @@
+#include <lib/out.h>
+#include <term/args.h>
+#include <core/iosched.h>
+#include <core/serial.h>
+#include <core/trace.h>
+#include <modules/mpx_supt.h>
+#include <serial_driver/driver.h>
+
+/**
+ * Handler for the trace command. --start begins streaming binary event records to COM2, or to
+ * the port given with -p, and --stop ends it. With neither it shows how many records were taken,
+ * sent and dropped.
+ *
+ * @param arg_str The arguments passed to the trace command.
+ *
+ * @return The exit code of the command, 0 on success or 1 if tracing could not start.
+ */
+int cmd_trace(char *arg_str) {
+	parsed_args *args = parse_args(arg_str);
+	if(args == NULL)
+		return 1;
+
+	int ports[4] = { COM1, COM2, COM3, COM4 };
+	int port = TRACE_PORT, num, rc, ret = 0;
+	u32int taken, sent, lost;
+	char *val;
+
+	if(named_arg(args, "p", &val)) {
+		num = atoi(val);
+		port = num >= 1 && num <= 4 ? ports[num - 1] : 0;
+	}
+
+	if(flag(args, "start")) {
+		if(port == 0 || port == serial_port_out) {
+			printf("Error: The trace port must be one of COM1 to COM4 other than the console\n");
+			ret = 1;
+		} else if(!com_is_open(port)) {
+			printf("Error: That port is not there\n");
+			ret = 1;
+		} else if((rc = trace_start(port)) == IO_BUSY) {
+			printf("Error: That port still has requests queued\n");
+			ret = 1;
+		} else if(rc != 0) {
+			printf("Error: Could not start tracing (%i)\n", rc);
+			ret = 1;
+		} else {
+			printf("Tracing at %i baud\n", TRACE_BAUD);
+		}
+	} else if(flag(args, "stop")) {
+		trace_stop();
+		printf("Tracing stopped\n");
+	} else {
+		trace_stats(&port, &taken, &sent, &lost);
+		printf("Tracing is %s. %u records taken, %u sent, %u dropped\n",
+			trace_on ? "on" : "off", taken, sent, lost);
+	}
+
+	sys_free_mem(args);
+	return ret;
+}
@@ -8,5 +8,9 @@
 #include "cmds/argtest.c"
 #include "cmds/pcb.c"
 #include "cmds/clear.c"
+#include "cmds/memprof.c"
+#include "cmds/setbaud.c"
+#include "cmds/dmesg.c"
+#include "cmds/trace.c"
 
 #endif
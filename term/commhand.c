@@ -112,6 +112,11 @@ cmd_mapping cmd_mappings[MAX_CMD_COUNT] = {
 		&suspendPCB,
 		""
 	},
+	{
+		"showstackpcb",
+		&showStack,
+		""
+	},
 	{
 		"resumeallpcb",
 		&resumeAll,
@@ -152,6 +157,16 @@ cmd_mapping cmd_mappings[MAX_CMD_COUNT] = {
 		&isEmpty,
 		""
 	},
+	{
+		"heapcheck",
+		&cmd_heapcheck,
+		""
+	},
+	{
+		"memprof",
+		&cmd_memprof,
+		""
+	},
 	{
 		"arg-test",
 		&cmd_argtest,
@@ -162,6 +177,21 @@ cmd_mapping cmd_mappings[MAX_CMD_COUNT] = {
 		&cmd_clear,
 		""
 	},
+	{
+		"setbaud",
+		&cmd_setbaud,
+		""
+	},
+	{
+		"dmesg",
+		&cmd_dmesg,
+		""
+	},
+	{
+		"trace",
+		&cmd_trace,
+		""
+	},
 	{
 		"alias",
 		&cmd_alias,
@@ -190,6 +220,10 @@ void commhand() {
 	// I changed the return type from 'int' to 'void' so I can call
 	// commhand using the dispatcher in kmain.c
 	syntax_init();
+	/* parsed arguments never outlive the command, so they are bumped out of an
+	 * arena that is emptied after each one. Without it they come from the heap
+	*/
+	sys_arena_init(CMD_ARENA_SIZE, MEM_TAG_ARGS);
 
 	char cmd_name[MAX_CMD_NAME_LEN + 1];
 	int cmd_name_len = 0;
@@ -271,6 +305,7 @@ void commhand() {
 			sys_req(EXIT,DEFAULT_DEVICE,NULL,NULL);
 		}
 		
+		sys_arena_reset();
 		sys_req(IDLE,DEFAULT_DEVICE,NULL,NULL);
 	}
 }
@@ -350,9 +385,13 @@ int cmd_alias(char *arg_str) {
 		return 1;
 	}
 
-	char *default_args = NULL;
-	named_arg(args, "a", &default_args);
-	char *cmd_name = (char *)sys_alloc_mem(strlen(args->unnamed_args[0]) + 1);
+	/* the parsed arguments are freed below, so the alias keeps its own copies */
+	char *default_args = NULL, *arg_val;
+	if(named_arg(args, "a", &arg_val)) {
+		default_args = (char *)sys_alloc_mem_tagged(strlen(arg_val) + 1, MEM_TAG_ALIAS);
+		strcpy(default_args, arg_val);
+	}
+	char *cmd_name = (char *)sys_alloc_mem_tagged(strlen(args->unnamed_args[0]) + 1, MEM_TAG_ALIAS);
 	strcpy(cmd_name, args->unnamed_args[0]);
 
 	cmd_mappings[cmd_count] = (cmd_mapping){
@@ -13,6 +13,7 @@
 #define MAX_CMD_FLAG_COUNT 10
 #define MAX_CMD_NAMED_ARG_COUNT 10
 #define MAX_CMD_UNNAMED_ARG_COUNT 10
+#define CMD_ARENA_SIZE 0x2000    /// Bytes set aside for the parsed arguments of one command, which are all dropped once it returns
 
 #define MAX_CMD_COUNT 200  /// The maximum number of commands that can exist in the system, including both built-in commands and user-defined aliases
 
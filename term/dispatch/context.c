@@ -29,6 +29,10 @@ pcb_t * dispatcher(char * name, void (* func) (void)) {
 		return NULL;
 	}
 	pcb->pcb_process_state = SUSPENDED_READY;
+
+	// Paint the stack so showstackpcb can find how deep it has ever been used
+	memset(pcb->pcb_stack_bottom, STACK_PAINT, MAX_STACK_SIZE);
+	pcb->pcb_stack_painted = 1;
 	
 	context * cp = (context *) pcb->pcb_stack_top;
 	memset(cp, 0, sizeof(context));
@@ -2,10 +2,39 @@
 
 #include <term/utils.h>
 #include <include/core/serial.h>
+#include <include/core/klog.h>
+#include <include/core/trace.h>
 
 /// Start address of the heap
 u32int start_addr;
 
+/// End address of the heap; nothing past it belongs to a block
+u32int end_addr;
+
+/// Whether free blocks are filled with MM_POISON_BYTE
+int heap_poison = 0;
+
+/// Blocks checked per scheduler tick, 0 when incremental checking is off
+int heap_check_rate = 0;
+
+/// Header the next incremental check starts at, 0 to start over
+u32int check_cursor = 0;
+
+/// Poison bytes of the block at check_cursor already verified, and the layout they belong to
+u32int check_offset = 0;
+u32int check_generation = 0;
+
+/// Bumped on every change to the block layout
+u32int heap_generation = 0;
+
+/// Address the next maintenance step starts looking for free blocks at
+u32int maint_addr = 0;
+
+/// Free block being cleared in the background, and how far along
+u32int zero_block = 0;
+u32int zero_done = 0;
+u32int zero_generation = 0;
+
 mcb_queue_s allocated;
 mcb_queue_s free;
 
@@ -21,10 +50,16 @@ int initHeap(u32int size) {
 	// Allocate to the heap
 	start_addr = kmalloc(fullHeapSize);
 	if (!start_addr) {
-		serial_println("Error: Something went wrong during kmalloc");
+		klog(KLOG_ERR, "Something went wrong during kmalloc");
 		return -1;
 	}
 
+	end_addr = start_addr + fullHeapSize;
+	check_cursor = 0;
+
+	// Clear it once so early callocs can skip it
+	memset((void *) start_addr, 0, fullHeapSize);
+
 	// Organize the heap. Both are of type FREE
 	// CMCB at the top of the heap w/ all the information
 	cmcb_s * head = (cmcb_s *) start_addr;
@@ -34,6 +69,7 @@ int initHeap(u32int size) {
 	strcpy(head->name,"Initial FMCB");
 	head->next = NULL;
 	head->prev = NULL;
+	head->zeroed = 1;
 
 	// Initialize free and allocated lists
 	fmcb->mcbq_head = head;
@@ -45,35 +81,19 @@ int initHeap(u32int size) {
 	return 0;
 }
 
-u32int allocateMemory(u32int size) {
-	// Calculate required size for allocated mcb
-	u32int required = size;
-	u32int ref_size;
+/**
+ * Allocates the start of a free block that is known to be large enough.
+ *
+ * @param queue Free block to allocate from
+ * @param required Amount of bytes to allocate
+ *
+ * @return Returns the address of the allocated memory
+ */
+static u32int allocateFrom(cmcb_s * queue, u32int required) {
+	u32int ref_size = queue->size;
 
-	// Is fmcb list empty?
-	if (fmcb->mcbq_head == NULL) {
-		serial_println("Error: Free Memory Control List is empty.");
-		return -1;
-	}
+	heap_generation++;
 
-	// Iterate through the free memory until a block 
-	// with enough space is found
-	cmcb_s * queue = fmcb->mcbq_head;
-	while (queue != NULL) {
-		if (queue->size >= required) {
-			ref_size = queue->size;
-			break;
-		}
-		
-		queue = queue->next;
-	}
-
-	// If no block with enough space is found, throw error
-	if (queue == NULL) {
-		serial_println("Error: No free memory available");
-		return -1;
-	}
-	
 	// Allocate memory
 	// 1. Remove mcb that has enough space from the free list
 	// 2. Allocate memory / Insert into allocated list
@@ -108,6 +128,7 @@ u32int allocateMemory(u32int size) {
 	newFMCB->addr = (u32int) newAMCB->addr + required + sizeof(cmcb_s);
 	newFMCB->size = (u32int) ref_size - sizeof(cmcb_s);
 	strcpy(newFMCB->name, "FMCB Block\0");
+	newFMCB->zeroed = newAMCB->zeroed; // its data was part of the same free block
 	newFMCB->next = NULL;
 	newFMCB->prev = NULL;
 
@@ -116,6 +137,169 @@ u32int allocateMemory(u32int size) {
 	return (u32int) newAMCB->addr;
 }
 
+u32int allocateMemory(u32int size) {
+	// Calculate required size for allocated mcb
+	u32int required = size;
+
+	// Is fmcb list empty?
+	if (fmcb->mcbq_head == NULL) {
+		klog(KLOG_ERR, "Free Memory Control List is empty.");
+		return -1;
+	}
+
+	// Iterate through the free memory until a block 
+	// with enough space is found
+	cmcb_s * queue = fmcb->mcbq_head;
+	while (queue != NULL) {
+		if (queue->size >= required)
+			break;
+		
+		queue = queue->next;
+	}
+
+	// If no block with enough space is found, throw error
+	if (queue == NULL) {
+		klog(KLOG_ERR, "No free memory available");
+		return -1;
+	}
+
+	return allocateFrom(queue, required);
+}
+
+u32int allocateAlignedMemory(u32int size, u32int align) {
+	u32int pad = 0;
+
+	// With align 0 the pad below would come out as -addr
+	if (align == 0 || (align & (align - 1)))
+		return -1;
+
+	// First free block that still fits once its start is padded to the alignment
+	cmcb_s * queue = fmcb->mcbq_head;
+	while (queue != NULL) {
+		pad = (align - (queue->addr & (align - 1))) & (align - 1);
+		// The padding stays behind as a free block of its own, so it needs room for a header
+		while (pad != 0 && pad < sizeof(cmcb_s) + MM_MIN_SPLIT)
+			pad += align;
+		if (queue->size >= pad + size)
+			break;
+
+		queue = queue->next;
+	}
+
+	if (queue == NULL) {
+		klog(KLOG_ERR, "No free memory available");
+		return -1;
+	}
+
+	if (pad != 0) {
+		heap_generation++;
+
+		// Split the free block so the second half starts on the alignment
+		cmcb_s * aligned = (cmcb_s *) (queue->addr + pad - sizeof(cmcb_s));
+		aligned->type = FREE;
+		aligned->addr = queue->addr + pad;
+		aligned->size = queue->size - pad;
+		strcpy(aligned->name, "FMCB Block");
+		aligned->zeroed = queue->zeroed;
+		aligned->next = NULL;
+		aligned->prev = NULL;
+
+		queue->size = pad - sizeof(cmcb_s);
+		insertFMCB(aligned);
+		queue = aligned;
+	}
+
+	return allocateFrom(queue, size);
+}
+
+u32int callocateMemory(u32int size) {
+	u32int addr = allocateMemory(size);
+	if (addr == (u32int) -1)
+		return addr;
+
+	// The header still tells whether the free block it came from was clean
+	cmcb_s * mcb = (cmcb_s *) (addr - sizeof(cmcb_s));
+	if (!mcb->zeroed)
+		memset((void *) addr, 0, mcb->size);
+	mcb->zeroed = 0; // the caller owns the contents from here on
+
+	return addr;
+}
+
+u32int resizeMemory(void * addr, u32int size) {
+	cmcb_s * mcb = (cmcb_s *) ((u32int) addr - sizeof(cmcb_s));
+
+	// Must be the header of an allocated block
+	if ((u32int) mcb < start_addr || (u32int) addr >= end_addr
+		|| mcb->type != ALLOCATED || mcb->addr != (u32int) addr)
+		return 0;
+	heap_generation++;
+
+	cmcb_s * below = (cmcb_s *) (mcb->addr + mcb->size);
+	int belowFree = (u32int) below < end_addr && below->type == FREE;
+
+	// Growing: only possible into the free block right below
+	if (size > mcb->size) {
+		if (!belowFree || mcb->size + sizeof(cmcb_s) + below->size < size)
+			return mcb->size;
+
+		u32int total = mcb->size + sizeof(cmcb_s) + below->size;
+		int zeroed = below->zeroed;
+		removeFMCB(below);
+		if (check_cursor == (u32int) below)
+			check_cursor = (u32int) mcb;
+
+		if (total - size <= sizeof(cmcb_s)) {
+			// Not enough left for another block
+			mcb->size = total;
+			return mcb->size;
+		}
+
+		// The rest of below stays free; its data is a part of below's data
+		cmcb_s * rest = (cmcb_s *) (mcb->addr + size);
+		rest->type = FREE;
+		rest->addr = (u32int) rest + sizeof(cmcb_s);
+		rest->size = total - size - sizeof(cmcb_s);
+		strcpy(rest->name, "FMCB Block");
+		rest->zeroed = zeroed;
+		rest->next = NULL;
+		rest->prev = NULL;
+		insertFMCB(rest);
+
+		mcb->size = size;
+		return mcb->size;
+	}
+
+	// Shrinking: the tail becomes a free block if it can hold a header
+	u32int tail = mcb->size - size;
+	if (tail == 0 || (tail <= sizeof(cmcb_s) && !belowFree))
+		return mcb->size;
+
+	cmcb_s * rest = (cmcb_s *) (mcb->addr + size);
+	u32int restSize = tail - sizeof(cmcb_s);
+	if (belowFree) {
+		// Take below in, its header moves up by tail bytes
+		removeFMCB(below);
+		if (check_cursor == (u32int) below)
+			check_cursor = (u32int) rest;
+		restSize = tail + below->size;
+	}
+
+	rest->type = FREE;
+	rest->addr = (u32int) rest + sizeof(cmcb_s);
+	rest->size = restSize;
+	strcpy(rest->name, "FMCB Block");
+	rest->zeroed = 0;
+	rest->next = NULL;
+	rest->prev = NULL;
+	insertFMCB(rest);
+	if (heap_poison)
+		memset((void *) rest->addr, MM_POISON_BYTE, rest->size);
+
+	mcb->size = size;
+	return mcb->size;
+}
+
 void removeFMCB(cmcb_s * cmcb) {
 
 	// Only free cmcb in the list (only head)
@@ -158,7 +342,7 @@ void removeFMCB(cmcb_s * cmcb) {
 		return;
 	}
 
-	serial_println("removeFMCB: No condition applies");
+	klog(KLOG_ERR, "removeFMCB: No condition applies");
 	return;
 }
 
@@ -166,7 +350,7 @@ void removeAMCB(cmcb_s * cmcb) {
 
 	// Ensure AMCB head exists
 	if (amcb->mcbq_head == NULL) {
-		serial_println("removeAMCB: No AMCB head exists");
+		klog(KLOG_ERR, "removeAMCB: No AMCB head exists");
 		return;
 	}
 
@@ -206,7 +390,7 @@ void removeAMCB(cmcb_s * cmcb) {
 
 		return;
 	}
-	serial_println("removeAMCB: No condition applies");
+	klog(KLOG_ERR, "removeAMCB: No condition applies");
 	return;
 }
 
@@ -233,7 +417,8 @@ void insertAMCB(cmcb_s * mcb) {
 			cmcb_s * pCmcb = queue->prev;
 
 			// Link everything up
-			pCmcb->next = mcb;
+			if (pCmcb != NULL)
+				pCmcb->next = mcb;
 			mcb->prev = pCmcb;
 			mcb->next = queue;
 			queue->prev = mcb;
@@ -251,7 +436,7 @@ void insertAMCB(cmcb_s * mcb) {
 		queue = queue->next;
 	}
 
-	serial_println("insertAMCB Error: MCB was not inserted");
+	klog(KLOG_ERR, "insertAMCB Error: MCB was not inserted");
 	return;
 }
 
@@ -278,7 +463,8 @@ void insertFMCB(cmcb_s * mcb) {
 			cmcb_s * pCmcb = queue->prev;
 
 			// Link everything up
-			pCmcb->next = mcb;
+			if (pCmcb != NULL)
+				pCmcb->next = mcb;
 			mcb->prev = pCmcb;
 			mcb->next = queue;
 			queue->prev = mcb;
@@ -297,7 +483,7 @@ void insertFMCB(cmcb_s * mcb) {
 		queue = queue->next;
 	}
 
-	serial_println("insertFMCB Error: MCB was not inserted");
+	klog(KLOG_ERR, "insertFMCB Error: MCB was not inserted");
 	return;
 }
 
@@ -310,7 +496,9 @@ int showAllocated(char *discard) {
 		return 0;
 	}
 	while(block != NULL) {
-		printf("Block %s - ", block->name);
+		// name the block after its owner when the profiler knows it
+		int tag = sys_mem_tag_of((void *) block->addr);
+		printf("Block %s - ", tag >= 0 ? sys_mem_tag_name(tag) : block->name);
 		if(block->type == ALLOCATED)
 			display_fg_color(RED);
 		else
@@ -327,7 +515,7 @@ int showAllocated(char *discard) {
 int freeMemory(void * addr) {
 	// Does an amcb list even exist?
 	if (amcb->mcbq_head == NULL) {
-		serial_println("Error: Allocated MCB list is empty");
+		klog(KLOG_ERR, "Allocated MCB list is empty");
 		return -1;
 	}
 
@@ -350,14 +538,16 @@ int freeMemory(void * addr) {
 
 	// MCB with address was not found
 	if (queue == NULL) {
-		serial_println("Error: No AMCB with specified address exists");
+		klog(KLOG_ERR, "No AMCB with specified address exists");
 		return -1;
 	}
 	
 	removeAMCB(queue);
+	heap_generation++;
 
 	// Assign space as free and insert into fmcb list
 	queue->type = FREE;
+	queue->zeroed = 0;
 	strcpy(queue->name, "New Free Block");
 
 	insertFMCB(queue);
@@ -365,8 +555,9 @@ int freeMemory(void * addr) {
 
 	// 2. Check below for free block
 	// 		2.a If one exists, merge
+	// The last block has nothing below it
 	cmcb_s * below = (cmcb_s *)(queue->addr + queue->size);
-	if (below->type == FREE) {
+	if ((u32int) below < end_addr && below->type == FREE) {
 
 		// Inherit qualities of below with newly created fmcb
 		queue->size = queue->size + below->size + sizeof(cmcb_s);
@@ -374,7 +565,12 @@ int freeMemory(void * addr) {
 
 		// Terminate below
 		removeFMCB(below);
+
+		// below's header is now data; don't let the checker start there
+		if (check_cursor == (u32int) below)
+			check_cursor = (u32int) queue;
 	}
+	cmcb_s * merged = queue;
 
 	// 3. Check above for free block
 	// 		3.a If one exists, merge
@@ -385,10 +581,14 @@ int freeMemory(void * addr) {
 
 			// Above inherits the qualities of current mcb
 			above->size = (u32int) above->size + queue->size + sizeof(cmcb_s);
+			above->zeroed = 0;
 			strcpy(above->name, queue->name);
 			
 			// Terminate current mcb
 			removeFMCB(queue);
+			if (check_cursor == (u32int) queue)
+				check_cursor = (u32int) above;
+			merged = above;
 
 			// Can only have one thing above
 			break;
@@ -396,6 +596,10 @@ int freeMemory(void * addr) {
 		above = above->next;
 	}
 
+	// Catch writes through dangling pointers on the next check
+	if (heap_poison)
+		memset((void *) merged->addr, MM_POISON_BYTE, merged->size);
+
 	return 0;
 }
 
@@ -433,3 +637,291 @@ int showFree(char * p) {
 
 	return 0;
 }
+
+
+/**
+ * Checks that a pointer is a block header lying inside the heap.
+ */
+static int inHeap(cmcb_s * mcb) {
+	return (u32int) mcb >= start_addr && (u32int) mcb + sizeof(cmcb_s) <= end_addr;
+}
+
+/**
+ * Logs a heap problem and the block it was found at.
+ */
+static void heapError(cmcb_s * mcb, char * msg) {
+	klog(KLOG_ERR, "Heap check: %s at block %p", msg, mcb);
+}
+
+/**
+ * Checks one block header and its list links.
+ *
+ * @param mcb Header of the block
+ * @param next Set to the header of the following block
+ *
+ * @return Returns a description of the first problem found, NULL if there is none
+ */
+static char *checkBlock(cmcb_s * mcb, u32int * next) {
+	if ((u32int) mcb + sizeof(cmcb_s) > end_addr)
+		return "header runs past the end of the heap";
+	if (mcb->type != ALLOCATED && mcb->type != FREE)
+		return "bad block type";
+	if (mcb->addr != (u32int) mcb + sizeof(cmcb_s))
+		return "address does not follow its header";
+	if (mcb->size > end_addr - mcb->addr)
+		return "block runs past the end of the heap";
+
+	mcb_queue_s * list = mcb->type == FREE ? fmcb : amcb;
+	if (mcb->prev == NULL) {
+		if (list->mcbq_head != mcb)
+			return "block is missing from its list";
+	} else {
+		if (list->mcbq_head == mcb)
+			return "list head has a previous block";
+		if (!inHeap(mcb->prev) || mcb->prev->next != mcb)
+			return "broken previous link";
+		if (mcb->prev->type != mcb->type)
+			return "block is in the wrong list";
+		if (mcb->prev->addr >= mcb->addr)
+			return "list is out of address order";
+	}
+	if (mcb->next != NULL) {
+		if (!inHeap(mcb->next) || mcb->next->prev != mcb)
+			return "broken next link";
+		if (mcb->next->addr <= mcb->addr)
+			return "list is out of address order";
+	}
+
+	*next = mcb->addr + mcb->size;
+	return NULL;
+}
+
+/**
+ * Checks part of the poison of a free block.
+ *
+ * @param mcb Header of a free block
+ * @param from Offset of the first byte to check
+ * @param len Number of bytes to check
+ *
+ * @return Returns a description of the problem, NULL if the bytes are intact
+ */
+static char *checkPoison(cmcb_s * mcb, u32int from, u32int len) {
+	unsigned char * data = (unsigned char *) mcb->addr;
+	u32int i;
+
+	for (i = from; i < from + len; i++)
+		if (data[i] != MM_POISON_BYTE)
+			return "free block was written to";
+	return NULL;
+}
+
+int checkHeap() {
+	u32int addr = start_addr, next;
+	int allocated = 0, freed = 0, missed = 0;
+	char * err;
+	cmcb_s * mcb, * last = NULL;
+
+	if (amcb->mcbq_head != NULL && !inHeap(amcb->mcbq_head)) {
+		heapError(amcb->mcbq_head, "allocated list head is outside the heap");
+		return -1;
+	}
+	if (fmcb->mcbq_head != NULL && !inHeap(fmcb->mcbq_head)) {
+		heapError(fmcb->mcbq_head, "free list head is outside the heap");
+		return -1;
+	}
+
+	// Every header is only reachable through the one before it, so stop at the first bad one
+	while (addr < end_addr) {
+		mcb = (cmcb_s *) addr;
+		if ((err = checkBlock(mcb, &next)) != NULL
+				|| (heap_poison && mcb->type == FREE && (err = checkPoison(mcb, 0, mcb->size)) != NULL)) {
+			heapError(mcb, err);
+			return -1;
+		}
+		if (mcb->type == ALLOCATED)
+			allocated++;
+		else {
+			freed++;
+			if (last != NULL && last->type == FREE)
+				missed++;
+		}
+		last = mcb;
+		addr = next;
+	}
+
+	printf("Heap OK: %i allocated blocks, %i free blocks", allocated, freed);
+	if (missed > 0)
+		printf(", %i free neighbours not merged", missed);
+	printf("\n");
+	return 0;
+}
+
+int checkHeapStep(int count) {
+	u32int next, len;
+	u32int budget = count * MM_CHECK_BYTES;
+	cmcb_s * mcb;
+	char * err = NULL;
+
+	// A split or merge may have moved the block whose poison was half checked
+	if (check_generation != heap_generation) {
+		check_generation = heap_generation;
+		check_offset = 0;
+	}
+
+	while (count > 0) {
+		if (check_cursor < start_addr || check_cursor >= end_addr) {
+			check_cursor = start_addr;
+			check_offset = 0;
+		}
+		mcb = (cmcb_s *) check_cursor;
+		if ((err = checkBlock(mcb, &next)) != NULL)
+			break;
+
+		if (heap_poison && mcb->type == FREE && check_offset < mcb->size) {
+			len = mcb->size - check_offset;
+			if (len > budget)
+				len = budget;
+			if ((err = checkPoison(mcb, check_offset, len)) != NULL)
+				break;
+			check_offset += len;
+			budget -= len;
+			// Out of bytes for this tick; the rest of the block is checked on the next one
+			if (check_offset < mcb->size)
+				return 0;
+		}
+
+		check_offset = 0;
+		check_cursor = next;
+		count--;
+	}
+
+	if (err != NULL) {
+		heapError(mcb, err);
+		check_cursor = 0;
+		check_offset = 0;
+		return -1;
+	}
+	return 0;
+}
+
+void checkHeapTick() {
+	if (heap_check_rate > 0 && checkHeapStep(heap_check_rate) < 0) {
+		heap_check_rate = 0;
+		klog(KLOG_WARN, "Heap check: incremental checking stopped");
+	}
+}
+
+void setHeapPoisoning(int enable) {
+	heap_poison = enable;
+	heap_generation++;
+	if (!enable)
+		return;
+
+	cmcb_s * mcb;
+	for (mcb = fmcb->mcbq_head; mcb != NULL; mcb = mcb->next) {
+		memset((void *) mcb->addr, MM_POISON_BYTE, mcb->size);
+		mcb->zeroed = 0;
+	}
+}
+
+int heapMaintain() {
+	cmcb_s * mcb;
+
+	// Zeroing in progress, unless the block layout changed underneath it
+	if (zero_block != 0 && zero_generation == heap_generation && !heap_poison) {
+		mcb = (cmcb_s *) zero_block;
+		u32int chunk = mcb->size - zero_done;
+		if (chunk > MM_ZERO_CHUNK)
+			chunk = MM_ZERO_CHUNK;
+		memset((void *) (mcb->addr + zero_done), 0, chunk);
+		zero_done += chunk;
+		if (zero_done >= mcb->size) {
+			mcb->zeroed = 1;
+			zero_block = 0;
+		}
+		return 1;
+	}
+	zero_block = 0;
+
+	// Free blocks are kept in address order, so this finds the next one to look at
+	for (mcb = fmcb->mcbq_head; mcb != NULL; mcb = mcb->next) {
+		if (mcb->addr < maint_addr)
+			continue;
+
+		// freeMemory only merges the block being freed; pick up neighbours it left behind
+		cmcb_s * below = (cmcb_s *) (mcb->addr + mcb->size);
+		if ((u32int) below < end_addr && below->type == FREE) {
+			u32int belowSize = below->size;
+			int belowZeroed = below->zeroed;
+
+			heap_generation++;
+			removeFMCB(below);
+			if (check_cursor == (u32int) below)
+				check_cursor = (u32int) mcb;
+
+			// Keep the merged block clean if both halves were, and poisoned if poisoning
+			if (heap_poison)
+				memset(below, MM_POISON_BYTE, sizeof(cmcb_s));
+			else if (mcb->zeroed && belowZeroed)
+				memset(below, 0, sizeof(cmcb_s));
+			else
+				mcb->zeroed = 0;
+			mcb->size += sizeof(cmcb_s) + belowSize;
+			return 1;
+		}
+
+		maint_addr = mcb->addr + mcb->size;
+		if (!mcb->zeroed && !heap_poison) {
+			zero_block = (u32int) mcb;
+			zero_done = 0;
+			zero_generation = heap_generation;
+			return 1;
+		}
+	}
+
+	// Reached the end; start over next time
+	maint_addr = 0;
+	return 0;
+}
+
+int idleMaintenance() {
+	int busy = klog_drain(KLOG_DRAIN_BATCH);
+	trace_drain();
+	refill_frame_cache();
+	return heapMaintain() || busy;
+}
+
+int cmd_heapcheck(char * arg_str) {
+	parsed_args * args = parse_args(arg_str);
+	if (args == NULL)
+		return 1;
+
+	char * rate;
+	int configured = 0;
+	if (flag(args, "poison")) {
+		setHeapPoisoning(1);
+		printf("Free blocks are now poisoned\n");
+		configured = 1;
+	}
+	if (flag(args, "nopoison")) {
+		setHeapPoisoning(0);
+		printf("Free blocks are no longer poisoned\n");
+		configured = 1;
+	}
+	if (named_arg(args, "k", &rate)) {
+		heap_check_rate = atoi(rate);
+		if (heap_check_rate < 0)
+			heap_check_rate = 0;
+		check_cursor = 0;
+		if (heap_check_rate > 0)
+			printf("Checking %i heap blocks per tick\n", heap_check_rate);
+		else
+			printf("Incremental heap checking is off\n");
+		configured = 1;
+	}
+	sys_free_mem(args);
+
+	if (configured)
+		return 0;
+	return checkHeap() < 0 ? 1 : 0;
+}
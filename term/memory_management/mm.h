@@ -1,6 +1,18 @@
 #ifndef MM_H
 #define MM_H 
 
+/// Smallest free block worth splitting off for alignment padding
+#define MM_MIN_SPLIT 16
+
+/// Bytes of free memory cleared per idle maintenance step
+#define MM_ZERO_CHUNK 1024
+
+/// Byte written over the data of free blocks when poisoning is enabled
+#define MM_POISON_BYTE 0xA5
+
+/// Poison bytes the incremental check may scan per block of its count
+#define MM_CHECK_BYTES 256
+
 /********************************************/
 /**************** Structures ****************/
 /********************************************/
@@ -15,7 +27,7 @@ typedef enum {
 } mcb_state_e;
 
 /// Complete Memory Control Block (CMBC) 
-typedef struct cmcb_s { // This is 52 bytes long
+typedef struct cmcb_s { // This is 56 bytes long
     /// The type of the CMCB    
     mcb_state_e type;
 
@@ -28,6 +40,9 @@ typedef struct cmcb_s { // This is 52 bytes long
     /// Name of CMCB
     char name[32];
 
+    /// Whether the data of the block is known to be all zero
+    int zeroed;
+
     /// Next CMCB
     struct cmcb_s * next;
 
@@ -117,6 +132,119 @@ int showFree(char * p);
 */
 int isEmpty();
 
+/**
+ * Allocate aligned memory from the heap.
+ * 
+ * Works like allocateMemory, but the returned address is a multiple
+ * of align. Padding in front of the block stays free for later use.
+ * 
+ * @params size Amount of bytes to be allocated from the heap
+ * @params align Alignment in bytes; a power of two
+ * 
+ * @return Returns the address of the block, -1 if align is 0 or not a power of two or no block fits
+*/
+u32int allocateAlignedMemory(u32int size, u32int align);
+
+/**
+ * Allocate zeroed memory from the heap.
+ * 
+ * Same as allocateMemory, but the block is cleared unless its
+ * memory is already known to be zero.
+ * 
+ * @params size Amount of bytes to be allocated from the heap
+ * 
+ * @return Returns the address of the block, -1 otherwise
+*/
+u32int callocateMemory(u32int size);
+
+/**
+ * Resize a block of memory in place
+ * 
+ * Shrinking splits the tail off as a free block. Growing takes
+ * space from the free block directly below, if there is one and
+ * it is large enough. The block never moves.
+ * 
+ * @params addr Address of an allocated block
+ * @params size New size of the block in bytes
+ * 
+ * @return Returns the size of the block afterwards, which is less
+ * 		   than size if it could not grow, or 0 if addr is not an allocated block
+*/
+u32int resizeMemory(void * addr, u32int size);
+
+/**
+ * Verifies the whole heap
+ * 
+ * Walks every block in address order and checks its header, its
+ * links in the allocated or free list and, when poisoning is enabled,
+ * that free blocks still hold the poison pattern. Problems are
+ * reported on the serial port.
+ * 
+ * @return Returns 0 if the heap is consistent, -1 otherwise
+*/
+int checkHeap();
+
+/**
+ * Verifies the next few blocks of the heap
+ * 
+ * Continues an address order walk where the previous call stopped,
+ * wrapping around at the end of the heap. Each block gets the same
+ * checks as in checkHeap. Poison is scanned at most count * MM_CHECK_BYTES
+ * bytes per call, and a large free block is finished on later calls,
+ * so the cost is bounded by count rather than by the size of the heap.
+ * 
+ * @param count Number of blocks to check
+ * 
+ * @return Returns 0 if the checked blocks are consistent, -1 otherwise
+*/
+int checkHeapStep(int count);
+
+/**
+ * Runs the incremental heap check for one scheduler tick
+ * 
+ * Checks the number of blocks set with the heapcheck command.
+ * Incremental checking stops after the first problem found.
+*/
+void checkHeapTick();
+
+/**
+ * Does one bounded step of background heap maintenance
+ * 
+ * Merges a free block with a free block directly below it, or clears
+ * up to MM_ZERO_CHUNK bytes of a free block so later callocs can skip
+ * it. Each call continues where the previous one stopped.
+ * 
+ * @return Returns 1 if some work was done, 0 if the heap needs none
+*/
+int heapMaintain();
+
+/**
+ * Idle process hook
+ * 
+ * Runs background maintenance on the heap and the frame cache.
+ * @return Returns 1 while the heap has more work left, 0 otherwise
+*/
+int idleMaintenance();
+
+/**
+ * Turns poisoning of free blocks on or off
+ * 
+ * Turning poisoning on fills every free block with MM_POISON_BYTE.
+ * 
+ * @param enable 1 to poison free blocks, 0 to stop
+*/
+void setHeapPoisoning(int enable);
+
+/**
+ * Handler for the heapcheck command
+ * 
+ * Runs a full check, or sets up poisoning and incremental checking.
+ * 
+ * @return Returns 0 upon success, 1 if the heap is corrupt or the
+ * 		   arguments are bad
+*/
+int cmd_heapcheck(char *);
+
 void removeFMCB(cmcb_s * mcb);
 
 void removeAMCB(cmcb_s * cmcb);
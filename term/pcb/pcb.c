@@ -7,6 +7,8 @@
 #include <term/utils.h>
 #include <term/args.h>
 #include <term/dispatch/context.h>
+#include <core/iosched.h>
+#include <core/trace.h>
 
 /*
 	We are going to have two queues for right now.
@@ -17,6 +19,9 @@ pcb_queue_t f_queue;
 pcb_queue_t * priority_queue = &p_queue;
 pcb_queue_t * fifo_queue = &f_queue;
 
+extern pcb_t * cop; // running process, defined in system.c
+void cancel_input_wait(pcb_t * pcb); // defined in system.c
+
 
 /********************************************************/
 /****************** Backend stuff here ******************/
@@ -36,14 +41,15 @@ void initPCB() {
 
 pcb_t * allocatePCB() {
 	/* Initialize PCB */
-	pcb_t *pcb = (pcb_t *) sys_alloc_mem(sizeof(pcb_t));
+	pcb_t *pcb = (pcb_t *) sys_alloc_mem_tagged(sizeof(pcb_t), MEM_TAG_PCB);
 
 	if (pcb == NULL) {
 		return NULL;
 	}
+	memset(pcb, '\0', sizeof(pcb_t));
 
 	/* Beginning of the stack (BP) */
-	pcb->pcb_stack_bottom = (unsigned char *) sys_alloc_mem(MAX_STACK_SIZE);
+	pcb->pcb_stack_bottom = (unsigned char *) sys_alloc_mem_aligned(MAX_STACK_SIZE, 16, MEM_TAG_PCB);
 	if (pcb->pcb_stack_bottom == NULL) {
 		return NULL;
 	}
@@ -52,7 +58,22 @@ pcb_t * allocatePCB() {
 	pcb->pcb_stack_top = pcb->pcb_stack_bottom + MAX_STACK_SIZE - sizeof(context);
 
 	/* Zero out memory in the stack frame (SF) */
-	memset(pcb, MAX_STACK_SIZE, '\0');
+	memset(pcb->pcb_stack_bottom, '\0', MAX_STACK_SIZE);
+
+	pcb->pcb_mem_limit = PCB_MEM_LIMIT;
+
+	/* A process inherits the private pages of the one creating it, copy-on-write.
+	   Processes with none of their own stay on kdir, which spares the TLB flush
+	   on every switch; sys_arena_init clones a directory when they need one */
+	pcb->pcb_page_dir = kdir;
+	if (cop != NULL && cop->pcb_page_dir != NULL && cop->pcb_page_dir != kdir) {
+		pcb->pcb_page_dir = clone_dir(cop->pcb_page_dir);
+		if (pcb->pcb_page_dir == NULL) {
+			sys_free_mem(pcb->pcb_stack_bottom);
+			sys_free_mem(pcb);
+			return NULL;
+		}
+	}
 
 	return pcb;
 }
@@ -61,7 +82,14 @@ int freePCB(pcb_t * pcb) {
 	// int free = sys_free_mem(pcb->pcb_stack_bottom);
 	//int free = sys_free_mem(pcb);
 	//return free;
-	(void)pcb;
+	// the driver must let go of the process's buffers before they are freed
+	io_cancel(pcb);
+	cancel_input_wait(pcb);
+	// release everything the process allocated. Its PCB, stack and queue
+	// nodes are tagged MEM_TAG_PCB, which is never charged to a process
+	sys_free_owner(pcb);
+	free_dir(pcb->pcb_page_dir);
+	pcb->pcb_page_dir = NULL;
 	return 0;
 }
 
@@ -77,6 +105,7 @@ pcb_t * setupPCB(char * name, int process_class, int priority) {
 	pcb->pcb_process_class = process_class;
 	pcb->pcb_priority = priority;
 	pcb->pcb_process_state = READY;
+	trace_name(pcb, pcb->pcb_name);
 
 	return pcb;
 }
@@ -125,9 +154,15 @@ int insertPCB(pcb_t * pcb) {
 			return 1;
 	}
 
+	// may run inside sys_call, so the node must not be charged to the running process
+	pcb_node_t *inserted_node = (pcb_node_t *)sys_alloc_mem_tagged(sizeof(pcb_node_t), MEM_TAG_PCB);
+	if(inserted_node == NULL) {
+		klog(KLOG_ERR, "No memory to queue PCB %s", pcb->pcb_name);
+		return 1;
+	}
+
 	if(queue->pcbq_head == NULL) {
 		// queue is empty - set this pcb as head and tail
-		pcb_node_t *inserted_node = (pcb_node_t *)sys_alloc_mem(sizeof(pcb_node_t));
 		// null next and prev nodes for new node
 		inserted_node->pcbn_next_pcb = NULL;
 		inserted_node->pcbn_prev_pcb = NULL;
@@ -144,7 +179,6 @@ int insertPCB(pcb_t * pcb) {
 		node = queue->pcbq_head;
 		if(node->pcb->pcb_priority < pcb->pcb_priority) {
 			// node is replacing queue's current head
-			pcb_node_t *inserted_node = (pcb_node_t *)sys_alloc_mem(sizeof(pcb_node_t));
 			inserted_node->pcbn_next_pcb = node;
 			inserted_node->pcbn_prev_pcb = NULL;
 			inserted_node->pcb = pcb;
@@ -161,7 +195,6 @@ int insertPCB(pcb_t * pcb) {
 	}
 	
 	// doubly linked lists sure are fun
-	pcb_node_t *inserted_node = (pcb_node_t *)sys_alloc_mem(sizeof(pcb_node_t));
 	inserted_node->pcbn_next_pcb = node->pcbn_next_pcb;
 	inserted_node->pcbn_prev_pcb = node;
 	inserted_node->pcb = pcb;
@@ -442,6 +475,14 @@ int showPCB(char *args) {
 	else
 		priority_str = "MAXIMUM";
 	printf("  Priority: %i [%s]\n", pcb->pcb_priority, priority_str);
+	printf("    Memory: %i bytes (peak %i", pcb->pcb_mem_used, pcb->pcb_mem_peak);
+	if(pcb->pcb_mem_limit > 0)
+		printf(", limit %i", pcb->pcb_mem_limit);
+	else
+		printf(", no limit");
+	if(pcb->pcb_mem_denied > 0)
+		printf(", %i denied", pcb->pcb_mem_denied);
+	printf(")\n");
 
 	return 0;
 }
@@ -490,6 +531,79 @@ int showAll(char *args) {
 	return 0;
 }
 
+int stackPeak(pcb_t * pcb) {
+	if (!pcb->pcb_stack_painted)
+		return -1;
+
+	// the stack grows down, so the lowest overwritten byte marks the peak
+	unsigned char * p = pcb->pcb_stack_bottom;
+	unsigned char * end = pcb->pcb_stack_bottom + MAX_STACK_SIZE;
+	while (p < end && *p == STACK_PAINT)
+		p++;
+
+	return end - p;
+}
+
+/**
+ * Prints one line of showstackpcb output for a PCB.
+ */
+static void showStackLine(pcb_t * pcb) {
+	int used = stackPeak(pcb);
+
+	printf("%s: ", pcb->pcb_name);
+	if (used < 0) {
+		printf("n/a (stack not painted)\n");
+		return;
+	}
+
+	int percent = used * 100 / MAX_STACK_SIZE;
+	printf("%i / %i bytes (%i%%)", used, MAX_STACK_SIZE, percent);
+	if (percent >= STACK_WARN_PERCENT) {
+		printf(" ");
+		display_fg_color(RED);
+		printf("near overflow");
+		display_reset();
+	}
+	printf("\n");
+}
+
+int showStack(char *args) {
+	char *pcb_name;
+
+	parsed_args *parsed_args = parse_args(args);
+	if(parsed_args == NULL)
+		return 1;
+
+	if(next_unnamed_arg(parsed_args, &pcb_name)) {
+		pcb_t *pcb = findPCB(pcb_name);
+		if(pcb == NULL && cop != NULL && strcmp(cop->pcb_name, pcb_name) == 0)
+			pcb = cop;
+		sys_free_mem(parsed_args);
+		if(pcb == NULL) {
+			printf("Error: PCB not found\n");
+			return 1;
+		}
+		showStackLine(pcb);
+		return 0;
+	}
+	sys_free_mem(parsed_args);
+
+	if(cop != NULL)
+		showStackLine(cop);
+
+	pcb_node_t *node = priority_queue->pcbq_head;
+	while(node != NULL) {
+		showStackLine(node->pcb);
+		node = node->pcbn_next_pcb;
+	}
+	node = fifo_queue->pcbq_head;
+	while(node != NULL) {
+		showStackLine(node->pcb);
+		node = node->pcbn_next_pcb;
+	}
+	return 0;
+}
+
 int suspendPCB(char *args) {
 	char *pcb_name;
 
@@ -1,9 +1,20 @@
 #ifndef PCB_H
 #define PCB_H
 
+#include <mem/paging.h>
+
 /// The maximum size the stack can be. May change
 #define MAX_STACK_SIZE 1024
 
+/// Byte every new stack is filled with, so untouched stack can be told apart from used stack
+#define STACK_PAINT 0xCD
+
+/// Bytes of output a process gathers before it is written out
+#define PCB_OUT_SIZE 128
+
+/// Stack usage, in percent, at which showstackpcb warns about a near overflow
+#define STACK_WARN_PERCENT 90
+
 /// Maximum priority a PCB can be given
 #define MAX_PRIORITY 9
 /// Minimum priority a PCB can be given
@@ -12,6 +23,9 @@
 /// Maximum name size that can be given to a pcb
 #define MAX_NAME_SIZE 32
 
+/// Default number of heap bytes a process may hold at once. 0 means no limit
+#define PCB_MEM_LIMIT 8192
+
 /********************************************/
 /**************** Structures ****************/
 /********************************************/
@@ -70,6 +84,48 @@ typedef struct {
     
     /// Beginning of the Stack
     unsigned char * pcb_stack_bottom;
+
+    /// Set once the stack has been painted with STACK_PAINT by the dispatcher
+    int pcb_stack_painted;
+
+    /// Address space of the process. kdir until it or its creator maps private pages
+    page_dir * pcb_page_dir;
+
+    /// Bytes allocated while the process was running that are still live
+    unsigned int pcb_mem_used;
+
+    /// Highest value pcb_mem_used has reached
+    unsigned int pcb_mem_peak;
+
+    /// Most bytes the process may hold at once. 0 means no limit
+    unsigned int pcb_mem_limit;
+
+    /// Number of allocations refused because of pcb_mem_limit
+    unsigned int pcb_mem_denied;
+
+    /// Start of the arena allocations are bumped from. NULL when arena mode is off
+    unsigned char * pcb_arena_base;
+
+    /// Next free byte of the arena
+    unsigned char * pcb_arena_next;
+
+    /// End of the arena
+    unsigned char * pcb_arena_end;
+
+    /// The one MEM_TAG_* the arena serves
+    int pcb_arena_tag;
+
+    /// Output waiting for a newline, a full buffer or flush(). Kept NUL terminated
+    char pcb_out_buf[PCB_OUT_SIZE + 1];
+
+    /// Number of bytes in pcb_out_buf
+    int pcb_out_len;
+
+    /// Set while the process reads from the terminal, so line editing shows up at once
+    int pcb_out_direct;
+
+    /// Result of the last READ or WRITE sys_call queued for the process
+    int pcb_io_status;
 } pcb_t;
 
 /// Individual PCB nodes. Each PCB is associated with one node.
@@ -321,6 +377,27 @@ int showBlocked(char * args);
 */
 int showAll(char * args);
 
+/**
+ * Peak stack usage of a PCB
+ * Scans the stack from its lowest address for the first byte that
+ * no longer holds STACK_PAINT. Everything above that byte has been
+ * written at some point, so the result is the high-water mark rather
+ * than the current depth.
+ * @param pcb PCB to measure
+ * @return Number of stack bytes used at the peak, -1 if the stack was never painted
+*/
+int stackPeak(pcb_t * pcb);
+
+/**
+ * Show peak stack usage
+ * Displays the peak stack usage of the named PCB, or of the running
+ * PCB and every PCB in the ready and blocked queues when no name is
+ * given. Stacks at or above STACK_WARN_PERCENT are flagged.
+ * @param args Optional name of the PCB
+ * @return Returns 0 upon success, 1 upon error
+*/
+int showStack(char * args);
+
 /********************************************************/
 /********************* R4 Stuff Here ********************/
 /********************************************************/
@@ -0,0 +1,352 @@
+/*
+  ----- tracedec.c -----
+
+  Description..: Host side decoder for the binary event trace the
+      kernel streams with the trace command (see kernel/core/trace.c).
+      Turns the stream into CSV or Chrome trace JSON, which loads in
+      chrome://tracing or https://ui.perfetto.dev.
+
+  Build..: make tracedec
+
+  Capture..: give QEMU a second serial port that writes to a file,
+      e.g. qemu-system-i386 -nographic -kernel kernel.bin
+           -serial mon:stdio -serial file:trace.bin
+      then run "trace --start" in MPX.
+
+  Usage..: tracedec [-f csv|chrome] [-o OUTPUT] TRACE_FILE
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Must match include/core/trace.h */
+#define TRACE_VERSION 1
+#define TRACE_MAGIC   0x5452
+
+enum {
+  TRACE_START, TRACE_SYNC, TRACE_LOST, TRACE_SWITCH, TRACE_PCB,
+  TRACE_NAME, TRACE_SYSCALL, TRACE_BLOCK, TRACE_WAKE, TRACE_IRQ,
+  TRACE_IRQ_END, TRACE_ALLOC, TRACE_FREE, TRACE_EVENTS
+};
+
+static const char *event_names[TRACE_EVENTS] = {
+  "start", "sync", "lost", "switch", "pcb", "name", "syscall",
+  "block", "wake", "irq", "irq_end", "alloc", "free"
+};
+
+static const char *op_names[] = { "EXIT", "IDLE", "READ", "WRITE" };
+
+static const char *tag_names[] = {
+  "other", "pcb", "args", "history", "alias", "alarms"
+};
+#define TAGS (sizeof(tag_names) / sizeof(tag_names[0]))
+
+/* 12 bytes, little endian, no padding */
+struct record {
+  uint8_t event;
+  uint8_t aux;
+  uint16_t id;
+  uint32_t delta;
+  uint32_t value;
+};
+
+#define MAX_PCBS 256
+#define NAME_SIZE 33
+
+struct pcb_name {
+  uint32_t pcb;
+  char name[NAME_SIZE];
+};
+
+static struct pcb_name pcbs[MAX_PCBS];
+static int npcbs = 0;
+
+static int chrome = 0;
+static int first_event = 1;
+static FILE *out;
+
+static uint64_t now = 0;     /* ticks since the last TRACE_START */
+static uint32_t khz = 0;     /* ticks per millisecond, 0 if unknown */
+static uint32_t running = 0; /* pcb on the cpu, 0 for the kernel */
+static int64_t live[TAGS];
+
+static uint32_t get32(const unsigned char *b)
+{
+  return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static int read_record(FILE *in, struct record *r)
+{
+  unsigned char b[12];
+
+  if (fread(b, 1, sizeof(b), in) != sizeof(b))
+    return 0;
+  r->event = b[0];
+  r->aux = b[1];
+  r->id = b[2] | b[3] << 8;
+  r->delta = get32(b + 4);
+  r->value = get32(b + 8);
+  return 1;
+}
+
+static int is_start(const struct record *r)
+{
+  return r->event == TRACE_START && r->aux == TRACE_VERSION && r->id == TRACE_MAGIC;
+}
+
+/* Microseconds since the trace started; ticks if the rate is unknown */
+static double micros(void)
+{
+  return khz ? (double)now * 1000.0 / khz : (double)now;
+}
+
+static struct pcb_name *find_pcb(uint32_t pcb, int add)
+{
+  int i;
+
+  for (i = 0; i < npcbs; i++)
+    if (pcbs[i].pcb == pcb)
+      return &pcbs[i];
+  if (!add || npcbs == MAX_PCBS)
+    return NULL;
+  pcbs[npcbs].pcb = pcb;
+  pcbs[npcbs].name[0] = '\0';
+  return &pcbs[npcbs++];
+}
+
+static const char *pcb_name(uint32_t pcb)
+{
+  static char buf[16];
+  struct pcb_name *p;
+
+  if (pcb == 0)
+    return "kernel";
+  p = find_pcb(pcb, 0);
+  if (p != NULL && p->name[0] != '\0')
+    return p->name;
+  snprintf(buf, sizeof(buf), "0x%08x", pcb);
+  return buf;
+}
+
+/* Escapes text for a JSON string, since PCB names are whatever the
+   user typed. The result lasts until the next call */
+static const char *json_escape(const char *s)
+{
+  static char buf[64 * 6 + 1];
+  size_t i = 0;
+
+  for (; *s != '\0' && i + 6 < sizeof(buf); s++) {
+    if (*s == '"' || *s == '\\') {
+      buf[i++] = '\\';
+      buf[i++] = *s;
+    } else if ((unsigned char)*s < 0x20) {
+      i += snprintf(buf + i, sizeof(buf) - i, "\\u%04x", (unsigned char)*s);
+    } else {
+      buf[i++] = *s;
+    }
+  }
+  buf[i] = '\0';
+  return buf;
+}
+
+static void chrome_event(const char *ph, const char *name, uint32_t tid, const char *args)
+{
+  fprintf(out, "%s\n{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+	  first_event ? "" : ",", ph, json_escape(name), tid, micros());
+  if (ph[0] == 'i')
+    fprintf(out, ",\"s\":\"t\"");
+  if (args != NULL)
+    fprintf(out, ",\"args\":{%s}", args);
+  fprintf(out, "}");
+  first_event = 0;
+}
+
+static void emit_chrome(const struct record *r)
+{
+  char name[64], args[96];
+
+  switch (r->event) {
+  case TRACE_SWITCH:
+    if (r->value == running)
+      return;
+    chrome_event("E", pcb_name(running), running, NULL);
+    running = r->value;
+    chrome_event("B", pcb_name(running), running, NULL);
+    break;
+  case TRACE_SYSCALL:
+    snprintf(name, sizeof(name), "sys_req %s", r->aux < 4 ? op_names[r->aux] : "?");
+    chrome_event("i", name, r->value, NULL);
+    break;
+  case TRACE_BLOCK:
+    snprintf(args, sizeof(args), "\"op\":\"%s\",\"device\":%u",
+	     r->aux < 4 ? op_names[r->aux] : "?", r->id);
+    chrome_event("i", "block on I/O", r->value, args);
+    break;
+  case TRACE_WAKE:
+    chrome_event("i", "wake", r->value, NULL);
+    break;
+  case TRACE_IRQ:
+  case TRACE_IRQ_END:
+    snprintf(name, sizeof(name), "IRQ%u", r->aux);
+    chrome_event(r->event == TRACE_IRQ ? "B" : "E", name, 1000 + r->aux, NULL);
+    break;
+  case TRACE_ALLOC:
+  case TRACE_FREE:
+    if (r->id < TAGS) {
+      live[r->id] += r->event == TRACE_ALLOC ? (int64_t)r->value : -(int64_t)r->value;
+      snprintf(args, sizeof(args), "\"%s\":%lld", tag_names[r->id], (long long)live[r->id]);
+      chrome_event("C", "heap live bytes", 0, args);
+    }
+    break;
+  case TRACE_LOST:
+    snprintf(args, sizeof(args), "\"records\":%u", r->value);
+    chrome_event("i", "records lost", running, args);
+    break;
+  }
+}
+
+static void emit_csv(const struct record *r)
+{
+  const char *detail = "";
+
+  switch (r->event) {
+  case TRACE_SWITCH:
+  case TRACE_BLOCK:
+  case TRACE_WAKE:
+  case TRACE_SYSCALL:
+    detail = pcb_name(r->value);
+    break;
+  case TRACE_ALLOC:
+  case TRACE_FREE:
+    detail = r->id < TAGS ? tag_names[r->id] : "";
+    break;
+  }
+  fprintf(out, "%.3f,%s,%u,%u,%u,%s\n", micros(),
+	  r->event < TRACE_EVENTS ? event_names[r->event] : "unknown",
+	  r->aux, r->id, r->value, detail);
+}
+
+/* Thread names so the Chrome viewer labels each row */
+static void chrome_names(void)
+{
+  int i;
+
+  fprintf(out, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":0,"
+	  "\"args\":{\"name\":\"kernel\"}}", first_event ? "" : ",");
+  for (i = 0; i < npcbs; i++)
+    fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%u,"
+	    "\"args\":{\"name\":\"%s\"}}", pcbs[i].pcb, json_escape(pcb_name(pcbs[i].pcb)));
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-f csv|chrome] [-o OUTPUT] TRACE_FILE\n", prog);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  struct record r;
+  struct pcb_name *naming = NULL;
+  uint64_t high = 0;
+  const char *in_name = NULL, *out_name = NULL;
+  int i, started = 0;
+  long skipped = 0;
+  FILE *in;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "chrome") == 0)
+	chrome = 1;
+      else if (strcmp(argv[i], "csv") != 0)
+	usage(argv[0]);
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      out_name = argv[++i];
+    } else if (argv[i][0] == '-' || in_name != NULL) {
+      usage(argv[0]);
+    } else {
+      in_name = argv[i];
+    }
+  }
+  if (in_name == NULL)
+    usage(argv[0]);
+
+  if ((in = fopen(in_name, "rb")) == NULL) {
+    perror(in_name);
+    return 1;
+  }
+  out = stdout;
+  if (out_name != NULL && (out = fopen(out_name, "w")) == NULL) {
+    perror(out_name);
+    return 1;
+  }
+
+  if (chrome)
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  else
+    fprintf(out, "time_us,event,aux,id,value,process\n");
+
+  while (read_record(in, &r)) {
+    /* anything before the first start record is noise on the line;
+       slide a byte at a time until the records line up */
+    if (!started && !is_start(&r)) {
+      fseek(in, -11, SEEK_CUR);
+      skipped++;
+      continue;
+    }
+
+    if (is_start(&r)) {
+      started = 1;
+      now = 0;
+      khz = r.value;
+      running = 0;
+      memset(live, 0, sizeof(live));
+      if (!chrome)
+	emit_csv(&r);
+      continue;
+    }
+
+    if (r.event == TRACE_SYNC) {
+      high = (uint64_t)r.value << 32;
+      continue;
+    }
+    now += high | r.delta;
+    high = 0;
+
+    switch (r.event) {
+    case TRACE_PCB:
+      naming = find_pcb(r.value, 1);
+      if (naming != NULL)
+	naming->name[0] = '\0';
+      continue;
+    case TRACE_NAME:
+      if (naming != NULL && r.aux * 4 + 4 < NAME_SIZE) {
+	memcpy(naming->name + r.aux * 4, &r.value, 4);
+	naming->name[r.aux * 4 + 4] = '\0';
+      }
+      continue;
+    }
+
+    if (chrome)
+      emit_chrome(&r);
+    else
+      emit_csv(&r);
+  }
+
+  if (chrome) {
+    chrome_names();
+    fprintf(out, "\n]}\n");
+  }
+  if (!started)
+    fprintf(stderr, "%s: no trace start record found\n", in_name);
+  else if (skipped)
+    fprintf(stderr, "%s: skipped %ld bytes before the first record\n", in_name, skipped);
+
+  fclose(in);
+  if (out != stdout)
+    fclose(out);
+  return started ? 0 : 1;
+}